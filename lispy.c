@@ -1,5 +1,20 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <ctype.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LVEC_X86 1
+#include <immintrin.h>
+#else
+#define LVEC_X86 0
+#endif
+
+//matmul splits large products over this many threads when defined
+#ifdef LMAT_THREADS
+#include <pthread.h>
+#endif
 
 // Helps in making REPL
 #include <editline/readline.h>
@@ -10,65 +25,377 @@
 
 struct lval;
 struct lenv;
+struct largs;
+struct lbig;
+struct lvec;
+struct lmat;
+struct lstr;
+struct lmap;
+struct lbytes;
+struct lseq;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct largs largs;
+typedef struct lbig lbig;
+typedef struct lvec lvec;
+typedef struct lmat lmat;
+typedef struct lstr lstr;
+typedef struct lmap lmap;
+typedef struct lbytes lbytes;
+typedef struct lseq lseq;
+
+//bignum limbs are half the widest integer the compiler multiplies into
+#ifdef __SIZEOF_INT128__
+typedef uint64_t lbig_limb;
+typedef unsigned __int128 lbig_dlimb;
+#define LBIG_BITS 64
+#define LBIG_BASE 18446744073709551616.0
+#else
+typedef uint32_t lbig_limb;
+typedef uint64_t lbig_dlimb;
+#define LBIG_BITS 32
+#define LBIG_BASE 4294967296.0
+#endif
+
+//strings shorter than LSTR_SMALL are stored inline in the lval, up to
+//LSTR_FLAT bytes are copied on concatenation
+#define LSTR_SMALL 16
+#define LSTR_FLAT 64
 
 //making a function pointer
-typedef lval*(*lbuiltin)(lenv*, lval*);
+typedef lval*(*lbuiltin)(lenv*, largs*);
 
 struct lval {
 
     int type;
     long number;
+    double dbl;
+    lbig* big;
+    lvec* vec;
+    lmat* mat;
 
     char* err;
     char* sym;
 
+    //str is NULL while the string fits in small
+    int len;
+    lstr* str;
+    char small[LSTR_SMALL];
+
+    //NULL for the empty map
+    lmap* map;
+
+    //a byte vector is the window [boff, boff + blen) of a shared buffer
+    lbytes* bytes;
+    long boff;
+    long blen;
+
+    lseq* seq;
+
     lbuiltin fun;
     lenv* env;
     lval* formals;
     lval* body;
 
+    //cell points at the first element, offset slots after the start of
+    //the allocation, which has room for capacity slots in total
     int count;
+    int capacity;
+    int offset;
     struct lval** cell;
 
+    /* sharing - refs is 0 for a privately owned value, otherwise the
+       number of owners of an immutable shared value */
+    int refs;
+    int interned;
+    unsigned long hash;
+    lval* next;
+
 };
 
 struct lenv {
 
     int count;
 
+    //frames are shared by closures and reference counted, a frame holds
+    //a reference to its parent
+    int refs;
     lenv* par;
 
     char** syms;
     lval** vals;
 };
 
-enum {LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR};
+struct lbig {
+
+    int neg;
+    int count;
+    lbig_limb* limb;
+};
+
+struct lvec {
+
+    int kind;
+    int count;
+    union {
+        void* data;
+        int64_t* i;
+        double* f;
+    };
+};
+
+//a dense row-major float64 matrix
+struct lmat {
+
+    int rows;
+    int cols;
+    double* data;
+};
+
+//a rope node, leaves hold their bytes in data, concatenations have children
+struct lstr {
+
+    int refs;
+    int len;
+    int depth;
+    lstr* left;
+    lstr* right;
+    char data[];
+};
+
+typedef struct {
+    unsigned long hash;
+    lval* key;
+    lval* val;
+} lmap_entry;
+
+//a trie node, data holds the entries of the slots in datamap and nodes
+//the children of the slots in nodemap, both in slot order
+struct lmap {
+
+    int refs;
+    int size;
+    uint32_t datamap;
+    uint32_t nodemap;
+    int ndata;
+    int nnodes;
+    lmap_entry* data;
+    lmap** nodes;
+};
+
+//storage shared by a byte vector and every slice of it, copied on write
+struct lbytes {
+
+    int refs;
+    unsigned char data[];
+};
+
+//a stage of a lazy sequence, fn is the function of a map or filter and
+//the list of a list source, take keeps its count in end
+struct lseq {
+
+    int refs;
+    int kind;
+    lseq* src;
+    lval* fn;
+    long start;
+    long end;
+    long step;
+};
+
+//iteration state, one per stage
+typedef struct lseq_iter {
+    lseq* seq;
+    struct lseq_iter* src;
+    long pos;
+} lseq_iter;
+
+enum {LSEQ_RANGE, LSEQ_LIST, LSEQ_MAP, LSEQ_FILTER, LSEQ_TAKE};
+
+//comparison state of a sort, the first error stops further calls to f
+typedef struct {
+    lenv* e;
+    lval* f;
+    lval** key;
+    lval* err;
+    char* name;
+} lsort;
+
+#define LMAP_BITS 5
+#define LMAP_MASK 31
+
+#define LMAT_PRINT 16
+#define LMAT_BLOCK_K 128
+#define LMAT_BLOCK_N 256
+#define LMAT_BLOCK_T 32
+
+//vector kernels, lvec_init points these at the best implementation
+typedef struct {
+    void (*binop_i64)(int64_t* r, int64_t* x, int xs, int64_t* y, int ys, int n, char op);
+    void (*binop_f64)(double* r, double* x, int xs, double* y, int ys, int n, char op);
+    int64_t (*sum_i64)(int64_t* x, int n);
+    double (*sum_f64)(double* x, int n);
+    int64_t (*dot_i64)(int64_t* x, int64_t* y, int n);
+    double (*dot_f64)(double* x, double* y, int n);
+    int64_t (*minmax_i64)(int64_t* x, int n, int max);
+    double (*minmax_f64)(double* x, int n, int max);
+    void (*gemm_f64)(double* c, double* a, double* b, int m, int n, int k);
+} lvec_kernels;
+
+//arguments passed to a builtin - the caller keeps ownership of every
+//element the builtin does not take with largs_take
+struct largs {
+
+    int count;
+    lval** cell;
+};
+
+enum {LVAL_NUM, LVAL_DBL, LVAL_BIG, LVAL_VEC, LVAL_MAT, LVAL_STR, LVAL_MAP, LVAL_BYTES, LVAL_SEQ, LVAL_ERR, LVAL_SYM, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR};
+
+enum {LVEC_I64, LVEC_F64};
+
+#define LVAL_IS_NUMBER(t) ((t) == LVAL_NUM || (t) == LVAL_DBL || (t) == LVAL_BIG)
 
 lval* lval_num(long x);
+lval* lval_dbl(double x);
+lval* lval_big(lbig* x);
+lval* lval_vec(lvec* x);
+lval* lval_mat(lmat* x);
+lval* lval_str(char* s);
+lval* lval_str_len(char* s, int len);
+char* lval_str_data(lval* v);
+lstr* lval_str_rope(lval* v);
+lval* lval_str_cat(lval* x, lval* y);
+lval* lval_map(void);
+int lval_map_size(lval* m);
+lval* lval_map_assoc(lval* m, lval* k, lval* v);
+lval* lval_bytes(long len);
+void lbytes_del(lbytes* x);
+uint64_t lbytes_load(unsigned char* p, int width, int big_endian);
+void lbytes_store(unsigned char* p, int width, int big_endian, uint64_t x);
+void lval_print_bytes(lval* v);
+lval* lval_seq(lseq* s);
+lseq* lval_to_seq(lval* v);
+lval* lval_apply(lenv* e, lval* f, int count, lval** cell);
+int lval_truthy(lval* v);
+lseq* lseq_new(int kind, lseq* src);
+lseq* lseq_share(lseq* s);
+void lseq_del(lseq* s);
+lseq_iter* lseq_iter_new(lseq* s);
+void lseq_iter_del(lseq_iter* it);
+lval* lseq_next(lenv* e, lseq_iter* it);
 lval* lval_err(char* s, ...);
 lval* lval_sym(char* s);
+lval* lval_sym_len(char* s, int len);
 lval* lval_fun(lbuiltin fun);
 lval* lval_sexpr(void);
 lval* lval_qexpr(void);
 lval* lval_copy(lval* v);
+lval* lval_dup(lval* v);
+lval* lval_unshare(lval* v);
 void lval_del(lval* v);
+unsigned long lval_hash(lval* v);
+int lval_eq(lval* x, lval* y);
+lval* lval_intern(lval* v);
+int lval_hc_same(lval* x, lval* y);
+void lval_hc_grow(void);
+void lval_hc_unlink(lval* v);
+lbig* lbig_new(int count);
+void lbig_del(lbig* x);
+lbig* lbig_copy(lbig* x);
+lbig* lbig_trim(lbig* x);
+lbig* lbig_from_u64(uint64_t n);
+uint64_t lbig_to_u64(lbig* x);
+lbig* lbig_from_long(long n);
+int lbig_fits_long(lbig* x);
+long lbig_to_long(lbig* x);
+double lbig_to_dbl(lbig* x);
+int lbig_clz(lbig_limb x);
+int lbig_cmp_mag(lbig_limb* a, int an, lbig_limb* b, int bn);
+lbig_limb lbig_add_mag(lbig_limb* r, lbig_limb* a, int an, lbig_limb* b, int bn);
+void lbig_sub_mag(lbig_limb* r, lbig_limb* a, int an, lbig_limb* b, int bn);
+void lbig_add_into(lbig_limb* r, lbig_limb* a, int an, int shift);
+void lbig_mul_school(lbig_limb* r, lbig_limb* a, int an, lbig_limb* b, int bn);
+void lbig_mul_karatsuba(lbig_limb* r, lbig_limb* a, lbig_limb* b, int n);
+void lbig_mul_mag(lbig_limb* r, lbig_limb* a, int an, lbig_limb* b, int bn);
+lbig_limb lbig_div_1(lbig_limb* q, lbig_limb* a, int an, lbig_limb d);
+void lbig_div_knuth(lbig_limb* q, lbig_limb* a, int an, lbig_limb* b, int bn);
+lbig* lbig_add(lbig* a, lbig* b);
+lbig* lbig_sub(lbig* a, lbig* b);
+lbig* lbig_add_signed(lbig* a, lbig* b, int bneg);
+lbig* lbig_mul(lbig* a, lbig* b);
+lbig* lbig_div(lbig* a, lbig* b);
+lbig* lbig_read(char* s);
+char* lbig_str(lbig* x);
+lvec* lvec_new(int kind, int count);
+void lvec_del(lvec* x);
+lvec* lvec_copy(lvec* x);
+double* lvec_f64(lvec* x, double** tmp);
+void lvec_init(void);
+lval* lvec_binop(lval* x, lval* y, char op);
+lmat* lmat_new(int rows, int cols);
+void lmat_del(lmat* x);
+lmat* lmat_copy(lmat* x);
+lmat* lmat_transpose(lmat* x);
+lmat* lmat_mul(lmat* x, lmat* y);
+lval* lmat_binop(lval* x, lval* y, char op);
+void lval_print_mat(lval* v);
+lstr* lstr_leaf(char* s, int len);
+lstr* lstr_concat(lstr* l, lstr* r);
+lstr* lstr_share(lstr* x);
+void lstr_del(lstr* x);
+void lstr_write(lstr* x, char* out);
+lstr* lstr_flatten(lstr* x);
+lstr* lstr_node(lstr* l, lstr* r);
+void lstr_split(lstr* x, lstr** l, lstr** r);
+lstr* lstr_join(lstr* l, lstr* r);
+int lstr_find(char* hay, int hn, char* needle, int nn, int from);
+lmap* lmap_new(int ndata, int nnodes);
+lmap* lmap_share(lmap* m);
+void lmap_del(lmap* m);
+lmap* lmap_clone(lmap* m, int extra_data, int extra_nodes);
+lmap_entry lmap_entry_copy(lmap_entry* e);
+lval* lmap_get(lmap* m, lval* k, unsigned long h);
+lmap* lmap_assoc(lmap* m, lmap_entry e, int shift, int* added);
+lmap* lmap_dissoc(lmap* m, lval* k, unsigned long h, int shift, int* removed);
+void lmap_each(lmap* m, void (*f)(lmap_entry*, void*), void* ctx);
+int lmap_eq(lmap* x, lmap* y);
+unsigned long lmap_hash(lmap* m);
+void lmap_add_key(lmap_entry* e, void* q);
+void lmap_add_val(lmap_entry* e, void* q);
+void lmap_print_entry(lmap_entry* e, void* first);
 lenv* lenv_new(void);
 lenv* lenv_copy(lenv* v);
+lenv* lenv_share(lenv* v);
 void lenv_def(lenv* e, lval* k, lval* v);
 void lenv_del(lenv* v);
 lval* lenv_get(lenv* e, lval* v);
 void lenv_put(lenv* e, lval* k, lval* v);
-lval* builtin_add(lenv* e, lval* a);
-lval* builtin_mul(lenv* e, lval* a);
-lval* builtin_min(lenv* e, lval* a);
-lval* builtin_div(lenv* e, lval* a);
+void lenv_def_move(lenv* e, lval* k, lval* v);
+void lenv_put_move(lenv* e, lval* k, lval* v);
+char* lval_sym_release(lval* k);
+lval* builtin_add(lenv* e, largs* a);
+lval* builtin_mul(lenv* e, largs* a);
+lval* builtin_min(lenv* e, largs* a);
+lval* builtin_div(lenv* e, largs* a);
 void lenv_add_builtin(lenv* e, char* name, lbuiltin fun);
 void lenv_add_builtins(lenv* e);
 lval* lval_add(lval* v, lval* x);
+void lval_reserve(lval* v, int n);
 lval* lval_read_num(mpc_ast_t* t);
+lval* lval_read_dbl(mpc_ast_t* t);
+lval* lval_read_str(mpc_ast_t* t);
+lval* lval_read_map(lval* x);
+void lval_fmt_dbl(char* buf, double x);
+void lval_print_dbl(double x);
+void lval_print_str(lval* v);
 lval* lval_read(mpc_ast_t* t);
+lval* lval_read_src(char* filename, char* s, char** err);
+int lread_is_sym(int c);
+lval* lread_num(char** p);
+lval* lread_str(char** p);
+char* lread_error(char* filename, char* s, char* at, char* expected);
+lval* builtin_load(lenv* e, largs* a);
 void lval_print_expr(lval* v, char open, char close);
 void lval_println(lval* v);
 void lval_print(lval* v);
@@ -76,46 +403,160 @@ lval* lval_eval_sexpr(lenv* e, lval* v);
 lval* lval_eval(lenv* e, lval* v);
 lval* lval_pop(lval* v, int i);
 lval* lval_take(lval* v, int i);
-lval* builtin_op(lenv* e, lval* v, char* op);
-lval* builtin_head(lenv* e, lval* a);
-lval* builtin_tail(lenv* e, lval* a);
-lval* builtin_list(lenv* e, lval* a);
-lval* builtin_eval(lenv* e, lval* a);
-lval* builtin_join(lenv* e, lval* a);
+lval* largs_take(largs* a, int i);
+lval* builtin_lambda(lenv* e, largs* a);
+lval* builtin_op(lenv* e, largs* a, char* op);
+lval* builtin_op_num(largs* a, char op);
+lval* builtin_op_dbl(largs* a, char op);
+lval* builtin_op_big(largs* a, char op);
+lbig* lval_to_big(lval* v);
+lval* builtin_op_vec(largs* a, char op);
+lval* builtin_vec_from(largs* a, char* name, int kind);
+lval* builtin_vec(lenv* e, largs* a);
+lval* builtin_fvec(lenv* e, largs* a);
+lval* builtin_vlist(lenv* e, largs* a);
+lval* builtin_sum(lenv* e, largs* a);
+lval* builtin_dot(lenv* e, largs* a);
+lval* builtin_minmax(largs* a, char* name, int max);
+lval* builtin_vmin(lenv* e, largs* a);
+lval* builtin_vmax(lenv* e, largs* a);
+lval* builtin_op_mat(largs* a, char op);
+lval* builtin_mat(lenv* e, largs* a);
+lval* builtin_mlist(lenv* e, largs* a);
+lval* builtin_mref(lenv* e, largs* a);
+lval* builtin_mdims(lenv* e, largs* a);
+lval* builtin_transpose(lenv* e, largs* a);
+lval* builtin_matmul(lenv* e, largs* a);
+lval* builtin_strlen(lenv* e, largs* a);
+lval* builtin_substr(lenv* e, largs* a);
+lval* builtin_find(lenv* e, largs* a);
+lval* builtin_split(lenv* e, largs* a);
+lval* builtin_str(lenv* e, largs* a);
+lval* builtin_num(lenv* e, largs* a);
+lval* builtin_get(lenv* e, largs* a);
+lval* builtin_assoc(lenv* e, largs* a);
+lval* builtin_dissoc(lenv* e, largs* a);
+lval* builtin_keys(lenv* e, largs* a);
+lval* builtin_vals(lenv* e, largs* a);
+lval* builtin_bget(largs* a, char* name, int width, int big_endian);
+lval* builtin_bset(largs* a, char* name, int width, int big_endian);
+lval* builtin_bytes(lenv* e, largs* a);
+lval* builtin_blen(lenv* e, largs* a);
+lval* builtin_blist(lenv* e, largs* a);
+lval* builtin_slice(lenv* e, largs* a);
+lval* builtin_get_u8(lenv* e, largs* a);
+lval* builtin_get_u16le(lenv* e, largs* a);
+lval* builtin_get_u16be(lenv* e, largs* a);
+lval* builtin_get_u32le(lenv* e, largs* a);
+lval* builtin_get_u32be(lenv* e, largs* a);
+lval* builtin_get_u64le(lenv* e, largs* a);
+lval* builtin_get_u64be(lenv* e, largs* a);
+lval* builtin_set_u8(lenv* e, largs* a);
+lval* builtin_set_u16le(lenv* e, largs* a);
+lval* builtin_set_u16be(lenv* e, largs* a);
+lval* builtin_set_u32le(lenv* e, largs* a);
+lval* builtin_set_u32be(lenv* e, largs* a);
+lval* builtin_set_u64le(lenv* e, largs* a);
+lval* builtin_set_u64be(lenv* e, largs* a);
+lval* builtin_bread(lenv* e, largs* a);
+lval* builtin_bwrite(lenv* e, largs* a);
+lval* builtin_range(lenv* e, largs* a);
+lval* builtin_stage(largs* a, char* name, int kind);
+lval* builtin_map(lenv* e, largs* a);
+lval* builtin_filter(lenv* e, largs* a);
+lval* builtin_take(lenv* e, largs* a);
+lval* builtin_reduce(lenv* e, largs* a);
+lval* builtin_collect(lenv* e, largs* a);
+lval* lval_elem(lval* q, int i);
+void lval_del_drained(lval* q);
+lval* builtin_each(lenv* e, largs* a, char* name, int keep);
+lval* builtin_fold(lenv* e, largs* a, char* name, int right);
+lval* builtin_foldl(lenv* e, largs* a);
+lval* builtin_foldr(lenv* e, largs* a);
+lval* builtin_len(lenv* e, largs* a);
+lval* builtin_nth(lenv* e, largs* a);
+lval* builtin_reverse(lenv* e, largs* a);
+int lval_order(lval* x, lval* y, int* bad);
+int lsort_order(lsort* s, lval* x, lval* y);
+int lsort_radix_keys(lval** key, int n, uint64_t* k);
+void lsort_radix(uint64_t* k, int* idx, int n);
+void lsort_merge(lsort* s, int* idx, int* tmp, int n);
+int lval_is_key_fn(lval* f);
+lval* builtin_sort(lenv* e, largs* a);
+lval* builtin_bsearch(lenv* e, largs* a);
+lval* builtin_math(lenv* e, largs* a, char* name, double (*f)(double));
+lval* builtin_sqrt(lenv* e, largs* a);
+lval* builtin_exp(lenv* e, largs* a);
+lval* builtin_log(lenv* e, largs* a);
+lval* builtin_floor(lenv* e, largs* a);
+lval* builtin_ceil(lenv* e, largs* a);
+lval* builtin_head(lenv* e, largs* a);
+lval* builtin_tail(lenv* e, largs* a);
+lval* builtin_list(lenv* e, largs* a);
+lval* builtin_eval(lenv* e, largs* a);
+lval* builtin_join(lenv* e, largs* a);
 lval* lval_join(lval* x, lval* y);
-lval* lval_lambda(lval* formals, lval* body);
-lval* builtin_var(lenv* e, lval* a, char* func);
-lval* builtin_def(lenv* e, lval* a);
-lval* builtin_put(lenv* e, lval* a);
+lval* lval_lambda(lenv* env, lval* formals, lval* body);
+lval* lval_freeze(lval* v);
+lval* lval_freeze_all(lval* v);
+lval* lval_call(lenv* e, lval* f, largs* a);
+lval* builtin_var(lenv* e, largs* a, char* func);
+lval* builtin_def(lenv* e, largs* a);
+lval* builtin_put(lenv* e, largs* a);
+lval* builtin_cmp(lenv* e, largs* a, char* op);
+lval* builtin_eq(lenv* e, largs* a);
+lval* builtin_ne(lenv* e, largs* a);
+
+//canonicalize atoms and Q-Expressions through a weak table when enabled
+int lval_hashcons = 0;
+
+//read input with the mpc grammar instead of lval_read_src
+int lval_use_mpc = 0;
 
 //defining a macro for error handling
-#define ERR_CHECK(arg, cond, s, ...) \
+#define ERR_CHECK(cond, s, ...) \
     if(!(cond)) { \
-        lval* err = lval_err(s, ##__VA_ARGS__); \
-        lval_del(arg); \
-        return err; \
+        return lval_err(s, ##__VA_ARGS__); \
     }; 
 
 
 int main(int argc, char** argv) {
 
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--hashcons") == 0) {
+            lval_hashcons = 1;
+        }
+        if(strcmp(argv[i], "--mpc") == 0) {
+            lval_use_mpc = 1;
+        }
+    }
+
+    lvec_init();
+
+    mpc_parser_t* Decimal = mpc_new("decimal");
     mpc_parser_t* Number = mpc_new("number");
+    mpc_parser_t* String = mpc_new("string");
     mpc_parser_t* Symbol = mpc_new("symbol");
     mpc_parser_t* Sexpr = mpc_new("sexpr");
     mpc_parser_t* Qexpr = mpc_new("qexpr");
+    mpc_parser_t* Map = mpc_new("map");
     mpc_parser_t* Expr = mpc_new("expr");
     mpc_parser_t* Lispy = mpc_new("lispy");
 
     mpca_lang(MPCA_LANG_DEFAULT, 
             "                                                                       \
+            decimal  : /-?[0-9]+\\.[0-9]+([eE][-+]?[0-9]+)?/ ;                      \
             number   : /-?[0-9]+/ ;                                                 \
+            string   : /\"(\\\\.|[^\"])*\"/ ;                                       \
             symbol   : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;                           \
             sexpr    : '(' <expr>* ')' ;                                            \
             qexpr    : '{' <expr>* '}' ;                                            \
-            expr     : <number> | <symbol> | <sexpr> | <qexpr> ;                    \
+            map      : '[' <expr>* ']' ;                                            \
+            expr     : <decimal> | <number> | <string> | <symbol>                   \
+                     | <sexpr> | <qexpr> | <map> ;                                  \
             lispy    : /^/ <expr>+ /$/ ;                                            \
             ",         
-            Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+            Decimal, Number, String, Symbol, Sexpr, Qexpr, Map, Expr, Lispy);
 
     puts("Lispy Version 0.0.1\n");
     puts("Press Ctrl+c to exit\n");
@@ -123,17 +564,40 @@ int main(int argc, char** argv) {
     lenv* e = lenv_new();
     lenv_add_builtins(e);
 
+    //the AST of each line lives in the arena until it has been read
+    mpc_arena_t* arena = mpc_arena_new();
+
     while(1) {
 
         char* input = readline("MyLisp>> ");
 
         add_history(input);
 
+        if(!lval_use_mpc) {
+
+            char* err;
+            lval* x = lval_read_src("<stdin>", input, &err);
+
+            if(x) {
+                lval* result = lval_eval(e, x);
+                lval_println(result);
+                lval_del(result);
+            } else {
+                printf("%s", err);
+                free(err);
+            }
+
+            free(input);
+            continue;
+        }
+
         mpc_result_t r;
 
-        if(mpc_parse("<stdin>", input, Lispy, &r)) {
+        if(mpc_parse_arena("<stdin>", input, Lispy, arena, &r)) {
             /* On Success Print the Result */
-            lval* result = lval_eval(e, lval_read(r.output));
+            lval* x = lval_read(r.output);
+            mpc_arena_clear(arena);
+            lval* result = lval_eval(e, x);
             lval_println(result);
             lval_del(result);
 
@@ -141,6 +605,7 @@ int main(int argc, char** argv) {
             /* Otherwise Print the Error */
             mpc_err_print(r.error);
             mpc_err_delete(r.error);
+            mpc_arena_clear(arena);
         }
 
         free(input);
@@ -148,8 +613,9 @@ int main(int argc, char** argv) {
     }
 
     lenv_del(e);
+    mpc_arena_delete(arena);
 
-    mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+    mpc_cleanup(9, Decimal, Number, String, Symbol, Sexpr, Qexpr, Map, Expr, Lispy);
 
     return 0;
 }
@@ -158,12 +624,192 @@ lval* lval_num(long x) {
     lval* v = malloc(sizeof(lval));
     v->type = LVAL_NUM;
     v->number = x;
+    v->refs = 0;
+    return v;
+}
+
+lval* lval_dbl(double x) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_DBL;
+    v->dbl = x;
+    v->refs = 0;
+    return v;
+}
+
+//adopts x, integers that fit in a long come back as LVAL_NUM
+lval* lval_big(lbig* x) {
+
+    if(lbig_fits_long(x)) {
+        lval* v = lval_num(lbig_to_long(x));
+        lbig_del(x);
+        return v;
+    }
+
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_BIG;
+    v->big = x;
+    v->refs = 0;
+    return v;
+}
+
+lval* lval_str_len(char* s, int len) {
+
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_STR;
+    v->refs = 0;
+    v->len = len;
+
+    if(len < LSTR_SMALL) {
+        v->str = NULL;
+        memcpy(v->small, s, len);
+        v->small[len] = '\0';
+    } else {
+        v->str = lstr_leaf(s, len);
+    }
+
+    return v;
+}
+
+lval* lval_str(char* s) {
+    return lval_str_len(s, strlen(s));
+}
+
+//contiguous, NUL terminated bytes of a string, flattening its rope
+char* lval_str_data(lval* v) {
+
+    if(!v->str) {
+        return v->small;
+    }
+
+    v->str = lstr_flatten(v->str);
+    return v->str->data;
+}
+
+//the rope of a long string, or a new leaf for an inline one
+lstr* lval_str_rope(lval* v) {
+    return v->str ? lstr_share(v->str) : lstr_leaf(v->small, v->len);
+}
+
+//adopts x and y
+lval* lval_str_cat(lval* x, lval* y) {
+
+    int len = x->len + y->len;
+    lval* v;
+
+    if(len <= LSTR_FLAT) {
+
+        //short results are copied, flat
+        char buf[LSTR_FLAT + 1];
+        memcpy(buf, lval_str_data(x), x->len);
+        memcpy(buf + x->len, lval_str_data(y), y->len);
+        v = lval_str_len(buf, len);
+
+    } else {
+
+        v = malloc(sizeof(lval));
+        v->type = LVAL_STR;
+        v->refs = 0;
+        v->len = len;
+
+        lstr* l = lval_str_rope(x);
+
+        //appending a short piece to a rope ending in a short leaf merges
+        //the two leaves so that char-at-a-time appends stay shallow
+        if(l->left && !l->right->left && l->right->len + y->len <= LSTR_FLAT) {
+
+            char buf[LSTR_FLAT];
+            memcpy(buf, l->right->data, l->right->len);
+            memcpy(buf + l->right->len, lval_str_data(y), y->len);
+
+            lstr* merged = lstr_concat(lstr_share(l->left), lstr_leaf(buf, l->right->len + y->len));
+            lstr_del(l);
+            v->str = merged;
+
+        } else {
+            v->str = lstr_concat(l, lval_str_rope(y));
+        }
+    }
+
+    lval_del(x);
+    lval_del(y);
+    return v;
+}
+
+lval* lval_map(void) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_MAP;
+    v->map = NULL;
+    v->refs = 0;
+    return v;
+}
+
+int lval_map_size(lval* m) {
+    return m->map ? m->map->size : 0;
+}
+
+//a new buffer of len uninitialized bytes, viewed whole, NULL if it cannot
+//be allocated
+lval* lval_bytes(long len) {
+    lbytes* b = malloc(sizeof(lbytes) + (len > 0 ? len : 1));
+    if(!b) {
+        return NULL;
+    }
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_BYTES;
+    v->refs = 0;
+    v->bytes = b;
+    v->bytes->refs = 1;
+    v->boff = 0;
+    v->blen = len;
+    return v;
+}
+
+void lbytes_del(lbytes* x) {
+    if(--x->refs == 0) {
+        free(x);
+    }
+}
+
+uint64_t lbytes_load(unsigned char* p, int width, int big_endian) {
+
+    uint64_t x = 0;
+
+    for(int i = 0; i < width; i++) {
+        x |= (uint64_t)p[big_endian ? width - 1 - i : i] << (8 * i);
+    }
+
+    return x;
+}
+
+void lbytes_store(unsigned char* p, int width, int big_endian, uint64_t x) {
+    for(int i = 0; i < width; i++) {
+        p[big_endian ? width - 1 - i : i] = (unsigned char)(x >> (8 * i));
+    }
+}
+
+//vectors are immutable, so they start out shared
+lval* lval_vec(lvec* x) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_VEC;
+    v->vec = x;
+    v->refs = 1;
+    v->interned = 0;
+    return v;
+}
+
+lval* lval_mat(lmat* x) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_MAT;
+    v->mat = x;
+    v->refs = 1;
+    v->interned = 0;
     return v;
 }
 
 lval* lval_err(char* s, ...) {
     lval* v = malloc(sizeof(lval));
     v->type = LVAL_ERR;
+    v->refs = 0;
 
     va_list list;
     va_start(list, s);
@@ -180,10 +826,16 @@ lval* lval_err(char* s, ...) {
 }
 
 lval* lval_sym(char* s) {
+    return lval_sym_len(s, strlen(s));
+}
+
+lval* lval_sym_len(char* s, int len) {
     lval* v = malloc(sizeof(lval));
     v->type = LVAL_SYM;
-    v->sym = malloc(strlen(s) + 1);
-    strcpy(v->sym, s);
+    v->sym = malloc(len + 1);
+    memcpy(v->sym, s, len);
+    v->sym[len] = '\0';
+    v->refs = 0;
     return v;
 }
 
@@ -191,6 +843,7 @@ lval* lval_fun(lbuiltin fun) {
     lval* v = malloc(sizeof(lval));
     v->type = LVAL_FUN;
     v->fun = fun;
+    v->refs = 0;
     return v;
 }
 
@@ -198,7 +851,10 @@ lval* lval_sexpr(void) {
     lval* v = malloc(sizeof(lval));
     v->type = LVAL_SEXPR;
     v->count = 0;
+    v->capacity = 0;
+    v->offset = 0;
     v->cell = NULL;
+    v->refs = 0;
     return v;
 }
 
@@ -206,20 +862,65 @@ lval* lval_qexpr(void) {
     lval* v = malloc(sizeof(lval));
     v->type = LVAL_QEXPR;
     v->count = 0;
+    v->capacity = 0;
+    v->offset = 0;
     v->cell = NULL;
+    v->refs = 0;
     return v;
 }
 
 lval* lval_copy(lval* v) {
 
+    //shared values are immutable, copying one is taking another reference
+    if(v->refs) {
+        v->refs++;
+        return v;
+    }
+
+    return lval_dup(v);
+}
+
+lval* lval_dup(lval* v) {
+
     lval* x = malloc(sizeof(lval));
 
     x->type = v->type;
+    x->refs = 0;
 
     switch(v->type) {
         case LVAL_NUM:
             x->number = v->number;
             break;
+        case LVAL_DBL:
+            x->dbl = v->dbl;
+            break;
+        case LVAL_BIG:
+            x->big = lbig_copy(v->big);
+            break;
+        case LVAL_VEC:
+            x->vec = lvec_copy(v->vec);
+            break;
+        case LVAL_MAT:
+            x->mat = lmat_copy(v->mat);
+            break;
+        case LVAL_MAP:
+            x->map = v->map ? lmap_share(v->map) : NULL;
+            break;
+        case LVAL_SEQ:
+            x->seq = lseq_share(v->seq);
+            break;
+        case LVAL_BYTES:
+            //copies are views of the same buffer
+            x->bytes = v->bytes;
+            x->bytes->refs++;
+            x->boff = v->boff;
+            x->blen = v->blen;
+            break;
+        case LVAL_STR:
+            x->len = v->len;
+            x->str = v->str ? lstr_share(v->str) : NULL;
+            memcpy(x->small, v->small, LSTR_SMALL);
+            break;
         case LVAL_FUN:
             if(v->fun) {
                 x->fun = v->fun;
@@ -227,7 +928,7 @@ lval* lval_copy(lval* v) {
                 x->fun = NULL;
                 x->formals = lval_copy(v->formals);
                 x->body = lval_copy(v->body);
-                x->env = lenv_copy(v->env);
+                x->env = lenv_share(v->env);
             }
             break;
         case LVAL_ERR:
@@ -241,6 +942,8 @@ lval* lval_copy(lval* v) {
         case LVAL_QEXPR:
         case LVAL_SEXPR:
             x->count = v->count;
+            x->capacity = v->count;
+            x->offset = 0;
             x->cell = malloc(sizeof(lval*) * x->count);
             for(int i = 0; i < v->count; i++) {
                 x->cell[i] = lval_copy(v->cell[i]);
@@ -251,10 +954,53 @@ lval* lval_copy(lval* v) {
     return x;
 }
 
+lval* lval_unshare(lval* v) {
+
+    //callers about to mutate v need a private copy if it is shared
+    if(!v->refs) {
+        return v;
+    }
+
+    lval* x = lval_dup(v);
+    lval_del(v);
+    return x;
+}
+
 void lval_del(lval* v) {
 
+    if(v->refs) {
+        if(--v->refs) {
+            return;
+        }
+        if(v->interned) {
+            lval_hc_unlink(v);
+        }
+    }
+
     switch(v->type) {
         case LVAL_NUM:
+        case LVAL_DBL:
+            break;
+        case LVAL_BIG:
+            lbig_del(v->big);
+            break;
+        case LVAL_VEC:
+            lvec_del(v->vec);
+            break;
+        case LVAL_MAT:
+            lmat_del(v->mat);
+            break;
+        case LVAL_STR:
+            lstr_del(v->str);
+            break;
+        case LVAL_MAP:
+            lmap_del(v->map);
+            break;
+        case LVAL_BYTES:
+            lbytes_del(v->bytes);
+            break;
+        case LVAL_SEQ:
+            lseq_del(v->seq);
             break;
         case LVAL_FUN:
             if(!(v->fun)) {
@@ -276,7 +1022,7 @@ void lval_del(lval* v) {
                 lval_del(v->cell[i]);
             }
 
-            free(v->cell);
+            free(v->cell - v->offset);
             break;
     }
 
@@ -284,359 +1030,4804 @@ void lval_del(lval* v) {
 
 }
 
-lenv* lenv_new(void) {
-    lenv* x = malloc(sizeof(lenv));
-    x->count = 0;
-    x->par = NULL;
-    x->syms = NULL;
-    x->vals = NULL;
-    return x;
-}
+/*
+ * Hash-consing. Interned values live in a weak hash table: the table owns
+ * no reference itself, a value unlinks itself once its last owner deletes
+ * it. Children of an interned Q-Expression are interned too, so two
+ * interned values are equal exactly when they are the same pointer.
+ */
 
-void lenv_del(lenv* v) {
-    for(int i = 0; i < v->count; i++) {
-        free(v->syms[i]);
-        lval_del(v->vals[i]);
+lval** hc_buckets = NULL;
+int hc_size = 0;
+int hc_count = 0;
+
+unsigned long lval_hash(lval* v) {
+
+    if(v->refs && v->interned) {
+        return v->hash;
     }
-    free(v->syms);
-    free(v->vals);
-    free(v);
-}
 
-lenv* lenv_copy(lenv* v) {
-    lenv* x = malloc(sizeof(lenv));
-    x->par = v->par;
-    x->count = v->count;
+    unsigned long h = 14695981039346656037UL;
 
-    for(int i = 0; i < x->count; i++) {
-        x->syms[i] = malloc(strlen(v->syms[i]) + 1);
-        strcpy(x->syms[i], v->syms[i]);
-        x->vals[i] = lval_copy(v->vals[i]);
+    switch(v->type) {
+        case LVAL_NUM:
+            h = (unsigned long)v->number * 0x9e3779b97f4a7c15UL;
+            break;
+        case LVAL_DBL: {
+            double d = v->dbl == 0 ? 0 : v->dbl;
+            memcpy(&h, &d, sizeof(h));
+            h = (h ^ LVAL_DBL) * 0x9e3779b97f4a7c15UL;
+            break;
+        }
+        case LVAL_BIG:
+            h ^= v->big->neg;
+            for(int i = 0; i < v->big->count; i++) {
+                h = (h ^ v->big->limb[i]) * 1099511628211UL;
+            }
+            break;
+        case LVAL_VEC:
+            h ^= v->vec->kind;
+            for(int i = 0; i < v->vec->count; i++) {
+                unsigned long x;
+                if(v->vec->kind == LVEC_F64) {
+                    double d = v->vec->f[i] == 0 ? 0 : v->vec->f[i];
+                    memcpy(&x, &d, sizeof(x));
+                } else {
+                    x = (unsigned long)v->vec->i[i];
+                }
+                h = (h ^ x) * 1099511628211UL;
+            }
+            break;
+        case LVAL_MAT: {
+            h ^= ((unsigned long)v->mat->rows << 32) ^ v->mat->cols;
+            long n = (long)v->mat->rows * v->mat->cols;
+            for(long i = 0; i < n; i++) {
+                unsigned long x;
+                double d = v->mat->data[i] == 0 ? 0 : v->mat->data[i];
+                memcpy(&x, &d, sizeof(x));
+                h = (h ^ x) * 1099511628211UL;
+            }
+            break;
+        }
+        case LVAL_SYM:
+            for(char* c = v->sym; *c; c++) {
+                h = (h ^ (unsigned char)*c) * 1099511628211UL;
+            }
+            break;
+        case LVAL_MAP:
+            h = lmap_hash(v->map) ^ LVAL_MAP;
+            break;
+        case LVAL_BYTES:
+            h ^= LVAL_BYTES;
+            for(long i = 0; i < v->blen; i++) {
+                h = (h ^ v->bytes->data[v->boff + i]) * 1099511628211UL;
+            }
+            break;
+        case LVAL_STR: {
+            char* c = lval_str_data(v);
+            h ^= LVAL_STR;
+            for(int i = 0; i < v->len; i++) {
+                h = (h ^ (unsigned char)c[i]) * 1099511628211UL;
+            }
+            break;
+        }
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            h ^= v->type;
+            for(int i = 0; i < v->count; i++) {
+                h = (h ^ lval_hash(v->cell[i])) * 1099511628211UL;
+            }
+            break;
+        default:
+            h = v->type;
+            break;
     }
-    return x;
 
+    return h ^ (h >> 29);
 }
 
-void lenv_def(lenv* e, lval* k, lval* v) {
+int lval_eq(lval* x, lval* y) {
 
-    while(e->par) {
-        e = e->par;
+    if(x == y) {
+        return 1;
+    }
+
+    //distinct canonical values are never equal
+    if(x->refs && x->interned && y->refs && y->interned) {
+        return 0;
+    }
+
+    if(x->type != y->type) {
+        return 0;
+    }
+
+    switch(x->type) {
+        case LVAL_NUM:
+            return x->number == y->number;
+        case LVAL_DBL:
+            return x->dbl == y->dbl;
+        case LVAL_BIG:
+            return x->big->neg == y->big->neg &&
+                lbig_cmp_mag(x->big->limb, x->big->count, y->big->limb, y->big->count) == 0;
+        case LVAL_VEC:
+            if(x->vec->kind != y->vec->kind || x->vec->count != y->vec->count) {
+                return 0;
+            }
+            for(int i = 0; i < x->vec->count; i++) {
+                if(x->vec->kind == LVEC_F64 ? x->vec->f[i] != y->vec->f[i] : x->vec->i[i] != y->vec->i[i]) {
+                    return 0;
+                }
+            }
+            return 1;
+        case LVAL_MAT:
+            if(x->mat->rows != y->mat->rows || x->mat->cols != y->mat->cols) {
+                return 0;
+            }
+            for(long i = 0; i < (long)x->mat->rows * x->mat->cols; i++) {
+                if(x->mat->data[i] != y->mat->data[i]) {
+                    return 0;
+                }
+            }
+            return 1;
+        case LVAL_ERR:
+            return strcmp(x->err, y->err) == 0;
+        case LVAL_SYM:
+            return strcmp(x->sym, y->sym) == 0;
+        case LVAL_STR:
+            return x->len == y->len && memcmp(lval_str_data(x), lval_str_data(y), x->len) == 0;
+        case LVAL_MAP:
+            return lval_map_size(x) == lval_map_size(y) && lmap_eq(x->map, y->map);
+        case LVAL_BYTES:
+            return x->blen == y->blen && memcmp(x->bytes->data + x->boff, y->bytes->data + y->boff, x->blen) == 0;
+        case LVAL_SEQ:
+            return x->seq == y->seq;
+        case LVAL_FUN:
+            if(x->fun || y->fun) {
+                return x->fun == y->fun;
+            }
+            return lval_eq(x->formals, y->formals) && lval_eq(x->body, y->body);
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            if(x->count != y->count) {
+                return 0;
+            }
+            for(int i = 0; i < x->count; i++) {
+                if(!lval_eq(x->cell[i], y->cell[i])) {
+                    return 0;
+                }
+            }
+            return 1;
     }
 
-    lenv_put(e, k, v);
+    return 0;
 }
 
-lval* lenv_get(lenv* e, lval* v) {
+//equality of a candidate against a table entry, children already canonical
+int lval_hc_same(lval* x, lval* y) {
 
-    for(int i = 0; i < e->count; i++) {
-        if(strcmp(e->syms[i], v->sym) == 0) {
-            return lval_copy(e->vals[i]);
-        }
+    if(x->type != y->type) {
+        return 0;
     }
 
-    if(e->par) {
-        return lenv_get(e->par, v);
-    } else {
-        return lval_err("Unbound Symbol '%s'", v->sym);
+    switch(x->type) {
+        case LVAL_NUM:
+            return x->number == y->number;
+        case LVAL_BIG:
+            return x->big->neg == y->big->neg &&
+                lbig_cmp_mag(x->big->limb, x->big->count, y->big->limb, y->big->count) == 0;
+        case LVAL_SYM:
+            return strcmp(x->sym, y->sym) == 0;
+        case LVAL_STR:
+            return x->len == y->len && memcmp(lval_str_data(x), lval_str_data(y), x->len) == 0;
+        case LVAL_QEXPR:
+            if(x->count != y->count) {
+                return 0;
+            }
+            for(int i = 0; i < x->count; i++) {
+                if(x->cell[i] != y->cell[i]) {
+                    return 0;
+                }
+            }
+            return 1;
     }
 
+    return 0;
 }
 
-void lenv_put(lenv* e, lval* k, lval* v) {
+void lval_hc_grow(void) {
 
-    for(int i = 0; i < e->count; i++) {
+    int size = hc_size ? hc_size * 2 : 1024;
+    lval** buckets = calloc(size, sizeof(lval*));
+
+    for(int i = 0; i < hc_size; i++) {
+        lval* v = hc_buckets[i];
+        while(v) {
+            lval* next = v->next;
+            v->next = buckets[v->hash & (size - 1)];
+            buckets[v->hash & (size - 1)] = v;
+            v = next;
+        }
+    }
+
+    free(hc_buckets);
+    hc_buckets = buckets;
+    hc_size = size;
+}
+
+void lval_hc_unlink(lval* v) {
+
+    lval** p = &hc_buckets[v->hash & (hc_size - 1)];
+
+    while(*p != v) {
+        p = &(*p)->next;
+    }
+
+    *p = v->next;
+    hc_count--;
+}
+
+lval* lval_intern(lval* v) {
+
+    if(!lval_hashcons || v->refs) {
+        return v;
+    }
+
+    //doubles are never interned, 0.0 and -0.0 are equal but distinct and
+    //NaN is equal to nothing, so neither fits one canonical value
+    switch(v->type) {
+        case LVAL_NUM:
+        case LVAL_BIG:
+        case LVAL_SYM:
+            break;
+        case LVAL_STR:
+            //hashing a rope would flatten it, making every join of a bound
+            //string copy the whole string
+            if(v->str && v->str->left) {
+                return v;
+            }
+            break;
+        case LVAL_QEXPR:
+            for(int i = 0; i < v->count; i++) {
+                v->cell[i] = lval_intern(v->cell[i]);
+                if(!v->cell[i]->refs || !v->cell[i]->interned) {
+                    return v;
+                }
+            }
+            break;
+        default:
+            return v;
+    }
+
+    if(hc_count >= hc_size) {
+        lval_hc_grow();
+    }
+
+    unsigned long h = lval_hash(v);
+
+    for(lval* x = hc_buckets[h & (hc_size - 1)]; x; x = x->next) {
+        if(x->hash == h && lval_hc_same(x, v)) {
+            x->refs++;
+            lval_del(v);
+            return x;
+        }
+    }
+
+    v->refs = 1;
+    v->interned = 1;
+    v->hash = h;
+    v->next = hc_buckets[h & (hc_size - 1)];
+    hc_buckets[h & (hc_size - 1)] = v;
+    hc_count++;
+
+    return v;
+}
+
+/*
+ * Bignums. Magnitudes are little-endian arrays of LBIG_BITS bit limbs
+ * without leading zero limbs, zero has no limbs. Integer arithmetic
+ * overflows into them and results that fit again are narrowed back to
+ * LVAL_NUM.
+ */
+
+#define LBIG_KARATSUBA 32
+
+//the largest power of ten that fits in a limb
+#if LBIG_BITS == 64
+#define LBIG_CHUNK 10000000000000000000UL
+#define LBIG_CHUNK_DIGITS 19
+#else
+#define LBIG_CHUNK 1000000000UL
+#define LBIG_CHUNK_DIGITS 9
+#endif
+
+lbig* lbig_new(int count) {
+    lbig* x = malloc(sizeof(lbig));
+    x->neg = 0;
+    x->count = count;
+    x->limb = calloc(count ? count : 1, sizeof(lbig_limb));
+    return x;
+}
+
+void lbig_del(lbig* x) {
+    free(x->limb);
+    free(x);
+}
+
+lbig* lbig_copy(lbig* x) {
+    lbig* y = lbig_new(x->count);
+    y->neg = x->neg;
+    memcpy(y->limb, x->limb, sizeof(lbig_limb) * x->count);
+    return y;
+}
+
+lbig* lbig_trim(lbig* x) {
+    while(x->count && x->limb[x->count - 1] == 0) {
+        x->count--;
+    }
+    if(x->count == 0) {
+        x->neg = 0;
+    }
+    return x;
+}
+
+//shifts are split in two so a full limb width never shifts a uint64_t by 64
+lbig* lbig_from_u64(uint64_t n) {
+    lbig* x = lbig_new(64 / LBIG_BITS);
+    for(int i = 0; i < 64 / LBIG_BITS; i++) {
+        x->limb[i] = (lbig_limb)n;
+        n = n >> (LBIG_BITS / 2) >> (LBIG_BITS / 2);
+    }
+    return lbig_trim(x);
+}
+
+//the magnitude of x, which must have at most 64 bits
+uint64_t lbig_to_u64(lbig* x) {
+    uint64_t n = 0;
+    for(int i = x->count - 1; i >= 0; i--) {
+        n = n << (LBIG_BITS / 2) << (LBIG_BITS / 2) | x->limb[i];
+    }
+    return n;
+}
+
+lbig* lbig_from_long(long n) {
+    lbig* x = lbig_from_u64(n < 0 ? -(uint64_t)n : (uint64_t)n);
+    x->neg = n < 0;
+    return x;
+}
+
+int lbig_fits_long(lbig* x) {
+    if(x->count > 64 / LBIG_BITS) {
+        return 0;
+    }
+    uint64_t n = lbig_to_u64(x);
+    return x->neg ? n <= (uint64_t)LONG_MAX + 1 : n <= LONG_MAX;
+}
+
+long lbig_to_long(lbig* x) {
+    uint64_t n = lbig_to_u64(x);
+    return x->neg ? (long)(-n) : (long)n;
+}
+
+double lbig_to_dbl(lbig* x) {
+    double d = 0;
+    for(int i = x->count - 1; i >= 0; i--) {
+        d = d * LBIG_BASE + (double)x->limb[i];
+    }
+    return x->neg ? -d : d;
+}
+
+int lbig_clz(lbig_limb x) {
+#if LBIG_BITS == 64
+    return __builtin_clzll(x);
+#else
+    int n = 0;
+    while(!(x & ((lbig_limb)1 << (LBIG_BITS - 1)))) {
+        x <<= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+int lbig_cmp_mag(lbig_limb* a, int an, lbig_limb* b, int bn) {
+    if(an != bn) {
+        return an < bn ? -1 : 1;
+    }
+    for(int i = an - 1; i >= 0; i--) {
+        if(a[i] != b[i]) {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+//r = a + b, r has room for max(an, bn) + 1 limbs, returns the carry
+lbig_limb lbig_add_mag(lbig_limb* r, lbig_limb* a, int an, lbig_limb* b, int bn) {
+
+    if(an < bn) {
+        lbig_limb* t = a; a = b; b = t;
+        int tn = an; an = bn; bn = tn;
+    }
+
+    lbig_limb carry = 0;
+
+    for(int i = 0; i < an; i++) {
+        lbig_dlimb s = (lbig_dlimb)a[i] + (i < bn ? b[i] : 0) + carry;
+        r[i] = (lbig_limb)s;
+        carry = (lbig_limb)(s >> LBIG_BITS);
+    }
+
+    r[an] = carry;
+    return carry;
+}
+
+//r = a - b for a >= b, r has room for an limbs
+void lbig_sub_mag(lbig_limb* r, lbig_limb* a, int an, lbig_limb* b, int bn) {
+
+    lbig_limb borrow = 0;
+
+    for(int i = 0; i < an; i++) {
+        lbig_limb y = i < bn ? b[i] : 0;
+        lbig_limb t = a[i] - y - borrow;
+        borrow = (a[i] < y) || (a[i] - y < borrow);
+        r[i] = t;
+    }
+}
+
+//r += a << (LBIG_BITS * shift), r must be long enough to absorb the carry
+void lbig_add_into(lbig_limb* r, lbig_limb* a, int an, int shift) {
+
+    lbig_limb carry = 0;
+    int i = 0;
+
+    for(; i < an; i++) {
+        lbig_dlimb s = (lbig_dlimb)r[i + shift] + a[i] + carry;
+        r[i + shift] = (lbig_limb)s;
+        carry = (lbig_limb)(s >> LBIG_BITS);
+    }
+
+    for(; carry; i++) {
+        lbig_dlimb s = (lbig_dlimb)r[i + shift] + carry;
+        r[i + shift] = (lbig_limb)s;
+        carry = (lbig_limb)(s >> LBIG_BITS);
+    }
+}
+
+//r = a * b, r is zeroed and has room for an + bn limbs
+void lbig_mul_school(lbig_limb* r, lbig_limb* a, int an, lbig_limb* b, int bn) {
+
+    for(int i = 0; i < an; i++) {
+
+        lbig_limb carry = 0;
+
+        for(int j = 0; j < bn; j++) {
+            lbig_dlimb p = (lbig_dlimb)a[i] * b[j] + r[i + j] + carry;
+            r[i + j] = (lbig_limb)p;
+            carry = (lbig_limb)(p >> LBIG_BITS);
+        }
+
+        r[i + bn] = carry;
+    }
+}
+
+//karatsuba on two n limb operands, r is zeroed and has room for 2n limbs
+void lbig_mul_karatsuba(lbig_limb* r, lbig_limb* a, lbig_limb* b, int n) {
+
+    int m = n / 2;
+    int h = n - m;
+
+    //z0 = a0 * b0 and z2 = a1 * b1 go straight into their places in r
+    lbig_mul_mag(r, a, m, b, m);
+    lbig_mul_mag(r + 2 * m, a + m, h, b + m, h);
+
+    //z1 = (a0 + a1) * (b0 + b1) - z0 - z2
+    lbig_limb* sa = calloc(h + 1, sizeof(lbig_limb));
+    lbig_limb* sb = calloc(h + 1, sizeof(lbig_limb));
+    lbig_limb* z1 = calloc(2 * (h + 1), sizeof(lbig_limb));
+
+    lbig_add_mag(sa, a + m, h, a, m);
+    lbig_add_mag(sb, b + m, h, b, m);
+    lbig_mul_mag(z1, sa, h + 1, sb, h + 1);
+
+    lbig_sub_mag(z1, z1, 2 * (h + 1), r, 2 * m);
+    lbig_sub_mag(z1, z1, 2 * (h + 1), r + 2 * m, 2 * h);
+
+    int z1n = 2 * (h + 1);
+    while(z1n && z1[z1n - 1] == 0) {
+        z1n--;
+    }
+    lbig_add_into(r, z1, z1n, m);
+
+    free(sa);
+    free(sb);
+    free(z1);
+}
+
+void lbig_mul_mag(lbig_limb* r, lbig_limb* a, int an, lbig_limb* b, int bn) {
+
+    if(an < bn) {
+        lbig_limb* t = a; a = b; b = t;
+        int tn = an; an = bn; bn = tn;
+    }
+
+    if(bn < LBIG_KARATSUBA) {
+        lbig_mul_school(r, a, an, b, bn);
+        return;
+    }
+
+    if(an == bn) {
+        lbig_mul_karatsuba(r, a, b, an);
+        return;
+    }
+
+    //unbalanced, multiply b by bn limb slices of a
+    lbig_limb* t = malloc(sizeof(lbig_limb) * 2 * bn);
+
+    for(int i = 0; i < an; i += bn) {
+        int n = an - i < bn ? an - i : bn;
+        memset(t, 0, sizeof(lbig_limb) * (n + bn));
+        lbig_mul_mag(t, a + i, n, b, bn);
+        lbig_add_into(r, t, n + bn, i);
+    }
+
+    free(t);
+}
+
+//q = a / d for a single limb d, returns the remainder
+lbig_limb lbig_div_1(lbig_limb* q, lbig_limb* a, int an, lbig_limb d) {
+
+    lbig_dlimb rem = 0;
+
+    for(int i = an - 1; i >= 0; i--) {
+        lbig_dlimb cur = (rem << LBIG_BITS) | a[i];
+        q[i] = (lbig_limb)(cur / d);
+        rem = cur % d;
+    }
+
+    return (lbig_limb)rem;
+}
+
+//q = a / b for bn >= 2 and a >= b (Knuth, algorithm D), q has an - bn + 1 limbs
+void lbig_div_knuth(lbig_limb* q, lbig_limb* a, int an, lbig_limb* b, int bn) {
+
+    int s = lbig_clz(b[bn - 1]);
+
+    lbig_limb* vn = malloc(sizeof(lbig_limb) * bn);
+    lbig_limb* un = malloc(sizeof(lbig_limb) * (an + 1));
+
+    for(int i = bn - 1; i > 0; i--) {
+        vn[i] = s ? (b[i] << s) | (b[i - 1] >> (LBIG_BITS - s)) : b[i];
+    }
+    vn[0] = b[0] << s;
+
+    un[an] = s ? a[an - 1] >> (LBIG_BITS - s) : 0;
+    for(int i = an - 1; i > 0; i--) {
+        un[i] = s ? (a[i] << s) | (a[i - 1] >> (LBIG_BITS - s)) : a[i];
+    }
+    un[0] = a[0] << s;
+
+    for(int j = an - bn; j >= 0; j--) {
+
+        lbig_dlimb num = ((lbig_dlimb)un[j + bn] << LBIG_BITS) | un[j + bn - 1];
+        lbig_dlimb qhat = num / vn[bn - 1];
+        lbig_dlimb rhat = num % vn[bn - 1];
+
+        while((qhat >> LBIG_BITS) || qhat * vn[bn - 2] > ((rhat << LBIG_BITS) | un[j + bn - 2])) {
+            qhat--;
+            rhat += vn[bn - 1];
+            if(rhat >> LBIG_BITS) {
+                break;
+            }
+        }
+
+        lbig_limb carry = 0;
+        lbig_limb borrow = 0;
+
+        for(int i = 0; i < bn; i++) {
+            lbig_dlimb p = qhat * vn[i] + carry;
+            carry = (lbig_limb)(p >> LBIG_BITS);
+            lbig_limb lo = (lbig_limb)p;
+            lbig_limb u = un[i + j];
+            un[i + j] = u - lo - borrow;
+            borrow = (u < lo) || (u - lo < borrow);
+        }
+
+        lbig_limb u = un[j + bn];
+        un[j + bn] = u - carry - borrow;
+        borrow = (u < carry) || (u - carry < borrow);
+
+        //qhat was one too large, add the divisor back
+        if(borrow) {
+            qhat--;
+            lbig_limb c = 0;
+            for(int i = 0; i < bn; i++) {
+                lbig_dlimb t = (lbig_dlimb)un[i + j] + vn[i] + c;
+                un[i + j] = (lbig_limb)t;
+                c = (lbig_limb)(t >> LBIG_BITS);
+            }
+            un[j + bn] += c;
+        }
+
+        q[j] = (lbig_limb)qhat;
+    }
+
+    free(vn);
+    free(un);
+}
+
+lbig* lbig_add(lbig* a, lbig* b) {
+    return lbig_add_signed(a, b, b->neg);
+}
+
+lbig* lbig_sub(lbig* a, lbig* b) {
+    return lbig_add_signed(a, b, !b->neg);
+}
+
+//a + b with the sign of b taken as bneg
+lbig* lbig_add_signed(lbig* a, lbig* b, int bneg) {
+
+    lbig* r;
+    int n = a->count > b->count ? a->count : b->count;
+
+    if(a->neg == bneg) {
+        r = lbig_new(n + 1);
+        lbig_add_mag(r->limb, a->limb, a->count, b->limb, b->count);
+        r->neg = a->neg;
+        return lbig_trim(r);
+    }
+
+    //signs differ, subtract the smaller magnitude from the larger
+    r = lbig_new(n);
+
+    if(lbig_cmp_mag(a->limb, a->count, b->limb, b->count) < 0) {
+        lbig_sub_mag(r->limb, b->limb, b->count, a->limb, a->count);
+        r->neg = bneg;
+    } else {
+        lbig_sub_mag(r->limb, a->limb, a->count, b->limb, b->count);
+        r->neg = a->neg;
+    }
+
+    return lbig_trim(r);
+}
+
+lbig* lbig_mul(lbig* a, lbig* b) {
+
+    lbig* r = lbig_new(a->count + b->count);
+
+    if(a->count && b->count) {
+        lbig_mul_mag(r->limb, a->limb, a->count, b->limb, b->count);
+    }
+
+    r->neg = a->neg != b->neg;
+    return lbig_trim(r);
+}
+
+//truncating division, b must not be zero
+lbig* lbig_div(lbig* a, lbig* b) {
+
+    if(lbig_cmp_mag(a->limb, a->count, b->limb, b->count) < 0) {
+        return lbig_new(0);
+    }
+
+    lbig* q = lbig_new(a->count - b->count + 1);
+
+    if(b->count == 1) {
+        lbig_div_1(q->limb, a->limb, a->count, b->limb[0]);
+    } else {
+        lbig_div_knuth(q->limb, a->limb, a->count, b->limb, b->count);
+    }
+
+    q->neg = a->neg != b->neg;
+    return lbig_trim(q);
+}
+
+//decimal digits are converted a chunk at a time, one limb operation per chunk
+lbig* lbig_read(char* s) {
+
+    int neg = *s == '-';
+    if(neg) {
+        s++;
+    }
+
+    int len = strlen(s);
+    lbig* x = lbig_new(len / LBIG_CHUNK_DIGITS + 1);
+    x->count = 0;
+
+    int first = len % LBIG_CHUNK_DIGITS ? len % LBIG_CHUNK_DIGITS : LBIG_CHUNK_DIGITS;
+
+    for(int i = 0; i < len; ) {
+
+        int n = i == 0 ? first : LBIG_CHUNK_DIGITS;
+        lbig_limb chunk = 0;
+        lbig_limb scale = 1;
+
+        for(int j = 0; j < n; j++) {
+            chunk = chunk * 10 + (s[i + j] - '0');
+            scale *= 10;
+        }
+        i += n;
+
+        //x = x * scale + chunk
+        lbig_limb carry = chunk;
+        for(int j = 0; j < x->count; j++) {
+            lbig_dlimb p = (lbig_dlimb)x->limb[j] * scale + carry;
+            x->limb[j] = (lbig_limb)p;
+            carry = (lbig_limb)(p >> LBIG_BITS);
+        }
+        if(carry) {
+            x->limb[x->count++] = carry;
+        }
+    }
+
+    x->neg = neg;
+    return lbig_trim(x);
+}
+
+char* lbig_str(lbig* x) {
+
+    if(x->count == 0) {
+        char* s = malloc(2);
+        strcpy(s, "0");
+        return s;
+    }
+
+    //peel off base 10^LBIG_CHUNK_DIGITS chunks from the low end
+    int n = x->count;
+    lbig_limb* q = malloc(sizeof(lbig_limb) * n);
+    lbig_limb* chunks = malloc(sizeof(lbig_limb) * (n * 2 + 1));
+    int count = 0;
+
+    memcpy(q, x->limb, sizeof(lbig_limb) * n);
+
+    while(n) {
+        chunks[count++] = lbig_div_1(q, q, n, LBIG_CHUNK);
+        while(n && q[n - 1] == 0) {
+            n--;
+        }
+    }
+
+    char* s = malloc(count * LBIG_CHUNK_DIGITS + 2);
+    char* p = s;
+
+    if(x->neg) {
+        *p++ = '-';
+    }
+
+    p += sprintf(p, "%lu", (unsigned long)chunks[count - 1]);
+    for(int i = count - 2; i >= 0; i--) {
+        p += sprintf(p, "%0*lu", LBIG_CHUNK_DIGITS, (unsigned long)chunks[i]);
+    }
+
+    free(q);
+    free(chunks);
+    return s;
+}
+
+/*
+ * Strings. Short strings are stored inline in the lval, longer ones in
+ * an immutable reference counted rope. Concatenation links ropes instead
+ * of copying, the rope is flattened in place the first time something
+ * needs the bytes contiguously.
+ */
+
+lstr* lstr_leaf(char* s, int len) {
+    lstr* x = malloc(sizeof(lstr) + len + 1);
+    x->refs = 1;
+    x->len = len;
+    x->depth = 0;
+    x->left = NULL;
+    x->right = NULL;
+    memcpy(x->data, s, len);
+    x->data[len] = '\0';
+    return x;
+}
+
+//adopts l and r. Ropes are kept height balanced like AVL trees: the
+//shallower one is joined in along the facing spine of the deeper one, so
+//appending to a rope of n leaves only rebuilds O(log n) nodes
+lstr* lstr_concat(lstr* l, lstr* r) {
+
+    lstr* a;
+    lstr* b;
+
+    if(l->depth > r->depth + 1) {
+        lstr_split(l, &a, &b);
+        return lstr_join(a, lstr_concat(b, r));
+    }
+
+    if(r->depth > l->depth + 1) {
+        lstr_split(r, &a, &b);
+        return lstr_join(lstr_concat(l, a), b);
+    }
+
+    return lstr_node(l, r);
+}
+
+lstr* lstr_share(lstr* x) {
+    x->refs++;
+    return x;
+}
+
+void lstr_del(lstr* x) {
+
+    while(x && --x->refs == 0) {
+        lstr* right = x->right;
+        if(x->left) {
+            lstr_del(x->left);
+        }
+        free(x);
+        x = right;
+    }
+}
+
+void lstr_write(lstr* x, char* out) {
+
+    while(x->left) {
+        lstr_write(x->left, out);
+        out += x->left->len;
+        x = x->right;
+    }
+    memcpy(out, x->data, x->len);
+}
+
+//adopts x, returns a single leaf with the same bytes
+lstr* lstr_flatten(lstr* x) {
+
+    if(!x->left) {
+        return x;
+    }
+
+    lstr* r = malloc(sizeof(lstr) + x->len + 1);
+    r->refs = 1;
+    r->len = x->len;
+    r->depth = 0;
+    r->left = NULL;
+    r->right = NULL;
+    lstr_write(x, r->data);
+    r->data[r->len] = '\0';
+
+    lstr_del(x);
+    return r;
+}
+
+//adopts l and r
+lstr* lstr_node(lstr* l, lstr* r) {
+
+    lstr* x = malloc(sizeof(lstr));
+    x->refs = 1;
+    x->len = l->len + r->len;
+    x->depth = (l->depth > r->depth ? l->depth : r->depth) + 1;
+    x->left = l;
+    x->right = r;
+    return x;
+}
+
+//adopts the concatenation x, giving back its two halves
+void lstr_split(lstr* x, lstr** l, lstr** r) {
+    *l = lstr_share(x->left);
+    *r = lstr_share(x->right);
+    lstr_del(x);
+}
+
+//adopts balanced l and r whose depths differ by at most two, rotating so
+//that the node over them is balanced too
+lstr* lstr_join(lstr* l, lstr* r) {
+
+    lstr* a;
+    lstr* b;
+    lstr* c;
+    lstr* d;
+
+    if(l->depth > r->depth + 1) {
+        lstr_split(l, &a, &b);
+        if(b->depth <= a->depth) {
+            return lstr_node(a, lstr_node(b, r));
+        }
+        lstr_split(b, &c, &d);
+        return lstr_node(lstr_node(a, c), lstr_node(d, r));
+    }
+
+    if(r->depth > l->depth + 1) {
+        lstr_split(r, &a, &b);
+        if(a->depth <= b->depth) {
+            return lstr_node(lstr_node(l, a), b);
+        }
+        lstr_split(a, &c, &d);
+        return lstr_node(lstr_node(l, c), lstr_node(d, b));
+    }
+
+    return lstr_node(l, r);
+}
+
+//first index of needle in hay at or after from, -1 if there is none
+int lstr_find(char* hay, int hn, char* needle, int nn, int from) {
+
+    if(nn == 0) {
+        return from <= hn ? from : -1;
+    }
+
+    int i = from;
+
+#ifdef __SSE2__
+    //compare the first and last needle byte 16 positions at a time and
+    //only memcmp where both match
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[nn - 1]);
+
+    for(; i + nn - 1 + 16 <= hn; i += 16) {
+
+        __m128i f = _mm_loadu_si128((__m128i*)(hay + i));
+        __m128i l = _mm_loadu_si128((__m128i*)(hay + i + nn - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(f, first), _mm_cmpeq_epi8(l, last)));
+
+        while(mask) {
+            int bit = __builtin_ctz(mask);
+            if(memcmp(hay + i + bit, needle, nn) == 0) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    while(i + nn <= hn) {
+
+        char* c = memchr(hay + i, needle[0], hn - nn + 1 - i);
+        if(!c) {
+            return -1;
+        }
+
+        i = c - hay;
+        if(memcmp(c, needle, nn) == 0) {
+            return i;
+        }
+        i++;
+    }
+
+    return -1;
+}
+
+/*
+ * Maps. A persistent hash array mapped trie: every node covers 5 bits of
+ * a key's hash, a bitmap says which of its 32 slots hold an entry and
+ * which a child node. Updates copy the path from the root and share the
+ * rest, so old versions of a map stay valid. Once the 64 hash bits run
+ * out, colliding keys share a node that is searched linearly. Keys and
+ * values are frozen on the way in, so nodes can share them too.
+ */
+
+lmap* lmap_new(int ndata, int nnodes) {
+
+    lmap* m = malloc(sizeof(lmap));
+    m->refs = 1;
+    m->size = 0;
+    m->datamap = 0;
+    m->nodemap = 0;
+    m->ndata = ndata;
+    m->nnodes = nnodes;
+    m->data = malloc(sizeof(lmap_entry) * (ndata > 0 ? ndata : 1));
+    m->nodes = malloc(sizeof(lmap*) * (nnodes > 0 ? nnodes : 1));
+    return m;
+}
+
+lmap* lmap_share(lmap* m) {
+    m->refs++;
+    return m;
+}
+
+void lmap_del(lmap* m) {
+
+    if(!m || --m->refs) {
+        return;
+    }
+
+    for(int i = 0; i < m->ndata; i++) {
+        lval_del(m->data[i].key);
+        lval_del(m->data[i].val);
+    }
+    for(int i = 0; i < m->nnodes; i++) {
+        lmap_del(m->nodes[i]);
+    }
+
+    free(m->data);
+    free(m->nodes);
+    free(m);
+}
+
+//a private copy of m with room for extra entries and children, sharing
+//everything m holds
+lmap* lmap_clone(lmap* m, int extra_data, int extra_nodes) {
+
+    lmap* r = lmap_new(m->ndata + extra_data, m->nnodes + extra_nodes);
+    r->size = m->size;
+    r->datamap = m->datamap;
+    r->nodemap = m->nodemap;
+    r->ndata = m->ndata;
+    r->nnodes = m->nnodes;
+
+    for(int i = 0; i < m->ndata; i++) {
+        r->data[i].hash = m->data[i].hash;
+        r->data[i].key = lval_copy(m->data[i].key);
+        r->data[i].val = lval_copy(m->data[i].val);
+    }
+    for(int i = 0; i < m->nnodes; i++) {
+        r->nodes[i] = lmap_share(m->nodes[i]);
+    }
+
+    return r;
+}
+
+lmap_entry lmap_entry_copy(lmap_entry* e) {
+    lmap_entry r = {e->hash, lval_copy(e->key), lval_copy(e->val)};
+    return r;
+}
+
+lval* lmap_get(lmap* m, lval* k, unsigned long h) {
+
+    for(int shift = 0; m; shift += LMAP_BITS) {
+
+        if(shift >= 64) {
+            for(int i = 0; i < m->ndata; i++) {
+                if(lval_eq(m->data[i].key, k)) {
+                    return m->data[i].val;
+                }
+            }
+            return NULL;
+        }
+
+        uint32_t bit = 1u << ((h >> shift) & LMAP_MASK);
+
+        if(m->datamap & bit) {
+            lmap_entry* e = &m->data[__builtin_popcount(m->datamap & (bit - 1))];
+            return e->hash == h && lval_eq(e->key, k) ? e->val : NULL;
+        }
+
+        if(!(m->nodemap & bit)) {
+            return NULL;
+        }
+
+        m = m->nodes[__builtin_popcount(m->nodemap & (bit - 1))];
+    }
+
+    return NULL;
+}
+
+//m with e added, or replacing the value of an equal key. Adopts e,
+//m may be NULL and is left untouched
+lmap* lmap_assoc(lmap* m, lmap_entry e, int shift, int* added) {
+
+    if(!m) {
+        m = lmap_new(1, 0);
+        m->ndata = 1;
+        m->size = 1;
+        m->datamap = shift < 64 ? 1u << ((e.hash >> shift) & LMAP_MASK) : 0;
+        m->data[0] = e;
+        *added = 1;
+        return m;
+    }
+
+    if(shift >= 64) {
+
+        for(int i = 0; i < m->ndata; i++) {
+            if(lval_eq(m->data[i].key, e.key)) {
+                lmap* r = lmap_clone(m, 0, 0);
+                lval_del(r->data[i].val);
+                lval_del(e.key);
+                r->data[i].val = e.val;
+                *added = 0;
+                return r;
+            }
+        }
+
+        lmap* r = lmap_clone(m, 1, 0);
+        r->data[r->ndata++] = e;
+        r->size++;
+        *added = 1;
+        return r;
+    }
+
+    uint32_t bit = 1u << ((e.hash >> shift) & LMAP_MASK);
+    int di = __builtin_popcount(m->datamap & (bit - 1));
+    int ni = __builtin_popcount(m->nodemap & (bit - 1));
+
+    if(m->datamap & bit) {
+
+        lmap_entry* old = &m->data[di];
+
+        if(old->hash == e.hash && lval_eq(old->key, e.key)) {
+            lmap* r = lmap_clone(m, 0, 0);
+            lval_del(r->data[di].val);
+            lval_del(e.key);
+            r->data[di].val = e.val;
+            *added = 0;
+            return r;
+        }
+
+        //two keys in one slot, both move down into a new child
+        lmap* child = lmap_assoc(NULL, lmap_entry_copy(old), shift + LMAP_BITS, added);
+        lmap* pushed = lmap_assoc(child, e, shift + LMAP_BITS, added);
+        lmap_del(child);
+
+        lmap* r = lmap_clone(m, 0, 1);
+        lval_del(r->data[di].key);
+        lval_del(r->data[di].val);
+        memmove(&r->data[di], &r->data[di + 1], sizeof(lmap_entry) * (r->ndata - di - 1));
+        r->ndata--;
+        r->datamap &= ~bit;
+
+        memmove(&r->nodes[ni + 1], &r->nodes[ni], sizeof(lmap*) * (r->nnodes - ni));
+        r->nodes[ni] = pushed;
+        r->nnodes++;
+        r->nodemap |= bit;
+
+        r->size++;
+        return r;
+    }
+
+    if(m->nodemap & bit) {
+
+        lmap* child = lmap_assoc(m->nodes[ni], e, shift + LMAP_BITS, added);
+
+        lmap* r = lmap_clone(m, 0, 0);
+        lmap_del(r->nodes[ni]);
+        r->nodes[ni] = child;
+        r->size += *added;
+        return r;
+    }
+
+    lmap* r = lmap_clone(m, 1, 0);
+    memmove(&r->data[di + 1], &r->data[di], sizeof(lmap_entry) * (r->ndata - di));
+    r->data[di] = e;
+    r->ndata++;
+    r->datamap |= bit;
+    r->size++;
+    *added = 1;
+    return r;
+}
+
+//m without key k, NULL once nothing is left. m is left untouched
+lmap* lmap_dissoc(lmap* m, lval* k, unsigned long h, int shift, int* removed) {
+
+    *removed = 0;
+
+    if(!m) {
+        return NULL;
+    }
+
+    int di = -1;
+    uint32_t bit = 0;
+
+    if(shift >= 64) {
+        for(int i = 0; i < m->ndata; i++) {
+            if(lval_eq(m->data[i].key, k)) {
+                di = i;
+            }
+        }
+    } else {
+
+        bit = 1u << ((h >> shift) & LMAP_MASK);
+
+        if(m->datamap & bit) {
+            int i = __builtin_popcount(m->datamap & (bit - 1));
+            if(m->data[i].hash == h && lval_eq(m->data[i].key, k)) {
+                di = i;
+            }
+        } else if(m->nodemap & bit) {
+
+            int ni = __builtin_popcount(m->nodemap & (bit - 1));
+            lmap* child = lmap_dissoc(m->nodes[ni], k, h, shift + LMAP_BITS, removed);
+
+            if(!*removed) {
+                lmap_del(child);
+                return lmap_share(m);
+            }
+
+            lmap* r = lmap_clone(m, 1, 0);
+            lmap_del(r->nodes[ni]);
+            r->size--;
+
+            //a child down to a single entry is folded back into this node
+            if(!child || (child->ndata == 1 && child->nnodes == 0)) {
+
+                memmove(&r->nodes[ni], &r->nodes[ni + 1], sizeof(lmap*) * (r->nnodes - ni - 1));
+                r->nnodes--;
+                r->nodemap &= ~bit;
+
+                if(child) {
+                    int at = __builtin_popcount(r->datamap & (bit - 1));
+                    memmove(&r->data[at + 1], &r->data[at], sizeof(lmap_entry) * (r->ndata - at));
+                    r->data[at] = lmap_entry_copy(&child->data[0]);
+                    r->ndata++;
+                    r->datamap |= bit;
+                    lmap_del(child);
+                }
+
+            } else {
+                r->nodes[ni] = child;
+            }
+
+            if(!r->size) {
+                lmap_del(r);
+                return NULL;
+            }
+
+            return r;
+        }
+    }
+
+    if(di < 0) {
+        return lmap_share(m);
+    }
+
+    *removed = 1;
+
+    if(m->size == 1) {
+        return NULL;
+    }
+
+    lmap* r = lmap_clone(m, 0, 0);
+    lval_del(r->data[di].key);
+    lval_del(r->data[di].val);
+    memmove(&r->data[di], &r->data[di + 1], sizeof(lmap_entry) * (r->ndata - di - 1));
+    r->ndata--;
+    r->datamap &= ~bit;
+    r->size--;
+    return r;
+}
+
+//calls f on every entry, children after the entries of a node
+void lmap_each(lmap* m, void (*f)(lmap_entry*, void*), void* ctx) {
+
+    if(!m) {
+        return;
+    }
+
+    for(int i = 0; i < m->ndata; i++) {
+        f(&m->data[i], ctx);
+    }
+    for(int i = 0; i < m->nnodes; i++) {
+        lmap_each(m->nodes[i], f, ctx);
+    }
+}
+
+//x and y hold the same keys with equal values, sizes already match
+int lmap_eq(lmap* x, lmap* y) {
+
+    if(!x || x == y) {
+        return 1;
+    }
+
+    for(int i = 0; i < x->ndata; i++) {
+        lval* v = lmap_get(y, x->data[i].key, x->data[i].hash);
+        if(!v || !lval_eq(v, x->data[i].val)) {
+            return 0;
+        }
+    }
+    for(int i = 0; i < x->nnodes; i++) {
+        if(!lmap_eq(x->nodes[i], y)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+//the same for equal maps however they were built
+unsigned long lmap_hash(lmap* m) {
+
+    unsigned long h = 0;
+
+    if(!m) {
+        return h;
+    }
+
+    for(int i = 0; i < m->ndata; i++) {
+        h += (m->data[i].hash ^ lval_hash(m->data[i].val)) * 0x9e3779b97f4a7c15UL;
+    }
+    for(int i = 0; i < m->nnodes; i++) {
+        h += lmap_hash(m->nodes[i]);
+    }
+
+    return h;
+}
+
+/*
+ * Lazy sequences. A sequence is an immutable chain of stages ending in
+ * a source, nothing runs until a consumer pulls elements through it one
+ * at a time. A pipeline of map, filter and take is therefore a single
+ * pass that never builds the intermediate lists.
+ */
+
+lseq* lseq_new(int kind, lseq* src) {
+    lseq* s = malloc(sizeof(lseq));
+    s->refs = 1;
+    s->kind = kind;
+    s->src = src;
+    s->fn = NULL;
+    s->start = 0;
+    s->end = 0;
+    s->step = 1;
+    return s;
+}
+
+lseq* lseq_share(lseq* s) {
+    s->refs++;
+    return s;
+}
+
+void lseq_del(lseq* s) {
+
+    while(s && --s->refs == 0) {
+        lseq* src = s->src;
+        if(s->fn) {
+            lval_del(s->fn);
+        }
+        free(s);
+        s = src;
+    }
+}
+
+lseq_iter* lseq_iter_new(lseq* s) {
+
+    lseq_iter* it = malloc(sizeof(lseq_iter));
+    it->seq = s;
+    it->src = s->src ? lseq_iter_new(s->src) : NULL;
+    it->pos = s->kind == LSEQ_RANGE ? s->start : 0;
+    return it;
+}
+
+void lseq_iter_del(lseq_iter* it) {
+    while(it) {
+        lseq_iter* src = it->src;
+        free(it);
+        it = src;
+    }
+}
+
+//the next element, an error from a stage, or NULL once exhausted
+lval* lseq_next(lenv* e, lseq_iter* it) {
+
+    lseq* s = it->seq;
+    lval* x;
+
+    switch(s->kind) {
+
+        case LSEQ_RANGE:
+            if(s->step > 0 ? it->pos >= s->end : it->pos <= s->end) {
+                return NULL;
+            }
+            x = lval_num(it->pos);
+            if(__builtin_add_overflow(it->pos, s->step, &it->pos)) {
+                it->pos = s->end;
+            }
+            return x;
+
+        case LSEQ_LIST:
+            return it->pos < s->fn->count ? lval_copy(s->fn->cell[it->pos++]) : NULL;
+
+        case LSEQ_TAKE:
+            if(it->pos >= s->end) {
+                return NULL;
+            }
+            it->pos++;
+            return lseq_next(e, it->src);
+
+        case LSEQ_MAP:
+            x = lseq_next(e, it->src);
+            if(!x || x->type == LVAL_ERR) {
+                return x;
+            }
+            return lval_apply(e, s->fn, 1, &x);
+
+        case LSEQ_FILTER:
+            while((x = lseq_next(e, it->src))) {
+
+                if(x->type == LVAL_ERR) {
+                    return x;
+                }
+
+                //x is both the argument and the result, share it
+                x = lval_freeze(x);
+                lval* arg = lval_copy(x);
+                lval* keep = lval_apply(e, s->fn, 1, &arg);
+
+                if(keep->type == LVAL_ERR) {
+                    lval_del(x);
+                    return keep;
+                }
+
+                int truth = lval_truthy(keep);
+                lval_del(keep);
+
+                if(truth) {
+                    return x;
+                }
+                lval_del(x);
+            }
+            return NULL;
+    }
+
+    return NULL;
+}
+
+/*
+ * Typed vectors. Elements are stored flat as int64 or float64 and a
+ * vector is immutable, so it is shared from birth and copying one is a
+ * reference count. int64 arithmetic wraps like the hardware does. The
+ * kernels come in generic, SSE2 and AVX2 flavours, lvec_init picks the
+ * widest one the CPU supports.
+ */
+
+lvec* lvec_new(int kind, int count) {
+    lvec* x = malloc(sizeof(lvec));
+    x->kind = kind;
+    x->count = count;
+    x->data = malloc((kind == LVEC_F64 ? sizeof(double) : sizeof(int64_t)) * (count > 0 ? count : 1));
+    return x;
+}
+
+void lvec_del(lvec* x) {
+    free(x->data);
+    free(x);
+}
+
+lvec* lvec_copy(lvec* x) {
+    lvec* r = lvec_new(x->kind, x->count);
+    memcpy(r->data, x->data, (x->kind == LVEC_F64 ? sizeof(double) : sizeof(int64_t)) * x->count);
+    return r;
+}
+
+//x as doubles, int64 vectors are converted into a buffer left in *tmp
+double* lvec_f64(lvec* x, double** tmp) {
+
+    *tmp = NULL;
+
+    if(x->kind == LVEC_F64) {
+        return x->f;
+    }
+
+    *tmp = malloc(sizeof(double) * (x->count > 0 ? x->count : 1));
+    for(int i = 0; i < x->count; i++) {
+        (*tmp)[i] = (double)x->i[i];
+    }
+    return *tmp;
+}
+
+//xs and ys are the strides of x and y, 0 broadcasts a scalar
+void lvec_binop_i64_generic(int64_t* r, int64_t* x, int xs, int64_t* y, int ys, int n, char op) {
+
+    switch(op) {
+        case '+':
+            for(int i = 0; i < n; i++) {
+                r[i] = (int64_t)((uint64_t)x[i * xs] + (uint64_t)y[i * ys]);
+            }
+            break;
+        case '-':
+            for(int i = 0; i < n; i++) {
+                r[i] = (int64_t)((uint64_t)x[i * xs] - (uint64_t)y[i * ys]);
+            }
+            break;
+        case '*':
+            for(int i = 0; i < n; i++) {
+                r[i] = (int64_t)((uint64_t)x[i * xs] * (uint64_t)y[i * ys]);
+            }
+            break;
+        case '/':
+            //divisors are checked for zero by the caller
+            for(int i = 0; i < n; i++) {
+                int64_t d = y[i * ys];
+                r[i] = d == -1 ? (int64_t)(0 - (uint64_t)x[i * xs]) : x[i * xs] / d;
+            }
+            break;
+    }
+}
+
+void lvec_binop_f64_generic(double* r, double* x, int xs, double* y, int ys, int n, char op) {
+
+    switch(op) {
+        case '+':
+            for(int i = 0; i < n; i++) {
+                r[i] = x[i * xs] + y[i * ys];
+            }
+            break;
+        case '-':
+            for(int i = 0; i < n; i++) {
+                r[i] = x[i * xs] - y[i * ys];
+            }
+            break;
+        case '*':
+            for(int i = 0; i < n; i++) {
+                r[i] = x[i * xs] * y[i * ys];
+            }
+            break;
+        case '/':
+            for(int i = 0; i < n; i++) {
+                r[i] = x[i * xs] / y[i * ys];
+            }
+            break;
+    }
+}
+
+int64_t lvec_sum_i64_generic(int64_t* x, int n) {
+    uint64_t s = 0;
+    for(int i = 0; i < n; i++) {
+        s += (uint64_t)x[i];
+    }
+    return (int64_t)s;
+}
+
+double lvec_sum_f64_generic(double* x, int n) {
+    double s = 0;
+    for(int i = 0; i < n; i++) {
+        s += x[i];
+    }
+    return s;
+}
+
+int64_t lvec_dot_i64_generic(int64_t* x, int64_t* y, int n) {
+    uint64_t s = 0;
+    for(int i = 0; i < n; i++) {
+        s += (uint64_t)x[i] * (uint64_t)y[i];
+    }
+    return (int64_t)s;
+}
+
+double lvec_dot_f64_generic(double* x, double* y, int n) {
+    double s = 0;
+    for(int i = 0; i < n; i++) {
+        s += x[i] * y[i];
+    }
+    return s;
+}
+
+//n is at least one
+int64_t lvec_minmax_i64_generic(int64_t* x, int n, int max) {
+    int64_t m = x[0];
+    for(int i = 1; i < n; i++) {
+        m = (max ? x[i] > m : x[i] < m) ? x[i] : m;
+    }
+    return m;
+}
+
+double lvec_minmax_f64_generic(double* x, int n, int max) {
+    double m = x[0];
+    for(int i = 1; i < n; i++) {
+        m = (max ? x[i] > m : x[i] < m) ? x[i] : m;
+    }
+    return m;
+}
+
+//c += a b for row-major m x k and k x n operands. A block of b rows stays
+//in cache while every row of a sweeps it
+void lmat_gemm_f64_generic(double* c, double* a, double* b, int m, int n, int k) {
+
+    for(int kk = 0; kk < k; kk += LMAT_BLOCK_K) {
+
+        int kn = k - kk < LMAT_BLOCK_K ? k - kk : LMAT_BLOCK_K;
+
+        for(int jj = 0; jj < n; jj += LMAT_BLOCK_N) {
+
+            int jn = n - jj < LMAT_BLOCK_N ? n - jj : LMAT_BLOCK_N;
+
+            for(int i = 0; i < m; i++) {
+                double* ci = c + (long)i * n + jj;
+                for(int p = 0; p < kn; p++) {
+                    double aip = a[(long)i * k + kk + p];
+                    double* bp = b + (long)(kk + p) * n + jj;
+                    for(int j = 0; j < jn; j++) {
+                        ci[j] += aip * bp[j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+#if LVEC_X86
+
+#define LVEC_SSE2_F64(OP) \
+    for(; i + 2 <= n; i += 2) { \
+        __m128d a = xs ? _mm_loadu_pd(x + i) : _mm_set1_pd(x[0]); \
+        __m128d b = ys ? _mm_loadu_pd(y + i) : _mm_set1_pd(y[0]); \
+        _mm_storeu_pd(r + i, OP(a, b)); \
+    }
+
+#define LVEC_SSE2_I64(OP) \
+    for(; i + 2 <= n; i += 2) { \
+        __m128i a = xs ? _mm_loadu_si128((__m128i*)(x + i)) : _mm_set1_epi64x(x[0]); \
+        __m128i b = ys ? _mm_loadu_si128((__m128i*)(y + i)) : _mm_set1_epi64x(y[0]); \
+        _mm_storeu_si128((__m128i*)(r + i), OP(a, b)); \
+    }
+
+#define LVEC_AVX2_F64(OP) \
+    for(; i + 4 <= n; i += 4) { \
+        __m256d a = xs ? _mm256_loadu_pd(x + i) : _mm256_set1_pd(x[0]); \
+        __m256d b = ys ? _mm256_loadu_pd(y + i) : _mm256_set1_pd(y[0]); \
+        _mm256_storeu_pd(r + i, OP(a, b)); \
+    }
+
+#define LVEC_AVX2_I64(OP) \
+    for(; i + 4 <= n; i += 4) { \
+        __m256i a = xs ? _mm256_loadu_si256((__m256i*)(x + i)) : _mm256_set1_epi64x(x[0]); \
+        __m256i b = ys ? _mm256_loadu_si256((__m256i*)(y + i)) : _mm256_set1_epi64x(y[0]); \
+        _mm256_storeu_si256((__m256i*)(r + i), OP(a, b)); \
+    }
+
+//there is no packed 64 bit multiply or divide before AVX-512, those
+//operators stay scalar and only the tail loop runs for them
+__attribute__((target("sse2")))
+void lvec_binop_i64_sse2(int64_t* r, int64_t* x, int xs, int64_t* y, int ys, int n, char op) {
+
+    int i = 0;
+
+    switch(op) {
+        case '+': LVEC_SSE2_I64(_mm_add_epi64); break;
+        case '-': LVEC_SSE2_I64(_mm_sub_epi64); break;
+    }
+
+    lvec_binop_i64_generic(r + i, x + i * xs, xs, y + i * ys, ys, n - i, op);
+}
+
+__attribute__((target("sse2")))
+void lvec_binop_f64_sse2(double* r, double* x, int xs, double* y, int ys, int n, char op) {
+
+    int i = 0;
+
+    switch(op) {
+        case '+': LVEC_SSE2_F64(_mm_add_pd); break;
+        case '-': LVEC_SSE2_F64(_mm_sub_pd); break;
+        case '*': LVEC_SSE2_F64(_mm_mul_pd); break;
+        case '/': LVEC_SSE2_F64(_mm_div_pd); break;
+    }
+
+    lvec_binop_f64_generic(r + i, x + i * xs, xs, y + i * ys, ys, n - i, op);
+}
+
+__attribute__((target("sse2")))
+int64_t lvec_sum_i64_sse2(int64_t* x, int n) {
+
+    __m128i s = _mm_setzero_si128();
+    int i = 0;
+
+    for(; i + 2 <= n; i += 2) {
+        s = _mm_add_epi64(s, _mm_loadu_si128((__m128i*)(x + i)));
+    }
+
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, s);
+    return (int64_t)((uint64_t)lanes[0] + (uint64_t)lanes[1] + (uint64_t)lvec_sum_i64_generic(x + i, n - i));
+}
+
+__attribute__((target("sse2")))
+double lvec_sum_f64_sse2(double* x, int n) {
+
+    __m128d s = _mm_setzero_pd();
+    int i = 0;
+
+    for(; i + 2 <= n; i += 2) {
+        s = _mm_add_pd(s, _mm_loadu_pd(x + i));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, s);
+    return lanes[0] + lanes[1] + lvec_sum_f64_generic(x + i, n - i);
+}
+
+__attribute__((target("sse2")))
+double lvec_dot_f64_sse2(double* x, double* y, int n) {
+
+    __m128d s = _mm_setzero_pd();
+    int i = 0;
+
+    for(; i + 2 <= n; i += 2) {
+        s = _mm_add_pd(s, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, s);
+    return lanes[0] + lanes[1] + lvec_dot_f64_generic(x + i, y + i, n - i);
+}
+
+__attribute__((target("sse2")))
+double lvec_minmax_f64_sse2(double* x, int n, int max) {
+
+    if(n < 2) {
+        return x[0];
+    }
+
+    __m128d m = _mm_loadu_pd(x);
+    int i = 2;
+
+    for(; i + 2 <= n; i += 2) {
+        __m128d a = _mm_loadu_pd(x + i);
+        m = max ? _mm_max_pd(m, a) : _mm_min_pd(m, a);
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, m);
+    double r = lvec_minmax_f64_generic(lanes, 2, max);
+
+    for(; i < n; i++) {
+        r = (max ? x[i] > r : x[i] < r) ? x[i] : r;
+    }
+    return r;
+}
+
+__attribute__((target("avx2")))
+void lvec_binop_i64_avx2(int64_t* r, int64_t* x, int xs, int64_t* y, int ys, int n, char op) {
+
+    int i = 0;
+
+    switch(op) {
+        case '+': LVEC_AVX2_I64(_mm256_add_epi64); break;
+        case '-': LVEC_AVX2_I64(_mm256_sub_epi64); break;
+    }
+
+    lvec_binop_i64_generic(r + i, x + i * xs, xs, y + i * ys, ys, n - i, op);
+}
+
+__attribute__((target("avx2")))
+void lvec_binop_f64_avx2(double* r, double* x, int xs, double* y, int ys, int n, char op) {
+
+    int i = 0;
+
+    switch(op) {
+        case '+': LVEC_AVX2_F64(_mm256_add_pd); break;
+        case '-': LVEC_AVX2_F64(_mm256_sub_pd); break;
+        case '*': LVEC_AVX2_F64(_mm256_mul_pd); break;
+        case '/': LVEC_AVX2_F64(_mm256_div_pd); break;
+    }
+
+    lvec_binop_f64_generic(r + i, x + i * xs, xs, y + i * ys, ys, n - i, op);
+}
+
+__attribute__((target("avx2")))
+int64_t lvec_sum_i64_avx2(int64_t* x, int n) {
+
+    __m256i s = _mm256_setzero_si256();
+    int i = 0;
+
+    for(; i + 4 <= n; i += 4) {
+        s = _mm256_add_epi64(s, _mm256_loadu_si256((__m256i*)(x + i)));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, s);
+    return (int64_t)((uint64_t)lvec_sum_i64_generic(lanes, 4) + (uint64_t)lvec_sum_i64_generic(x + i, n - i));
+}
+
+__attribute__((target("avx2")))
+double lvec_sum_f64_avx2(double* x, int n) {
+
+    __m256d s = _mm256_setzero_pd();
+    int i = 0;
+
+    for(; i + 4 <= n; i += 4) {
+        s = _mm256_add_pd(s, _mm256_loadu_pd(x + i));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, s);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + lvec_sum_f64_generic(x + i, n - i);
+}
+
+__attribute__((target("avx2")))
+double lvec_dot_f64_avx2(double* x, double* y, int n) {
+
+    __m256d s = _mm256_setzero_pd();
+    int i = 0;
+
+    for(; i + 4 <= n; i += 4) {
+        s = _mm256_add_pd(s, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, s);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + lvec_dot_f64_generic(x + i, y + i, n - i);
+}
+
+__attribute__((target("avx2")))
+int64_t lvec_minmax_i64_avx2(int64_t* x, int n, int max) {
+
+    if(n < 4) {
+        return lvec_minmax_i64_generic(x, n, max);
+    }
+
+    __m256i m = _mm256_loadu_si256((__m256i*)x);
+    int i = 4;
+
+    for(; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_loadu_si256((__m256i*)(x + i));
+        __m256i gt = max ? _mm256_cmpgt_epi64(a, m) : _mm256_cmpgt_epi64(m, a);
+        m = _mm256_blendv_epi8(m, a, gt);
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, m);
+    int64_t r = lvec_minmax_i64_generic(lanes, 4, max);
+
+    for(; i < n; i++) {
+        r = (max ? x[i] > r : x[i] < r) ? x[i] : r;
+    }
+    return r;
+}
+
+__attribute__((target("avx2")))
+double lvec_minmax_f64_avx2(double* x, int n, int max) {
+
+    if(n < 4) {
+        return lvec_minmax_f64_generic(x, n, max);
+    }
+
+    __m256d m = _mm256_loadu_pd(x);
+    int i = 4;
+
+    for(; i + 4 <= n; i += 4) {
+        __m256d a = _mm256_loadu_pd(x + i);
+        m = max ? _mm256_max_pd(m, a) : _mm256_min_pd(m, a);
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, m);
+    double r = lvec_minmax_f64_generic(lanes, 4, max);
+
+    for(; i < n; i++) {
+        r = (max ? x[i] > r : x[i] < r) ? x[i] : r;
+    }
+    return r;
+}
+
+//blocked like the generic kernel, with a 4 x 8 tile of c held in eight
+//registers across the whole k block. Edge rows and columns stay scalar
+__attribute__((target("avx2,fma")))
+void lmat_gemm_f64_avx2(double* c, double* a, double* b, int m, int n, int k) {
+
+    for(int kk = 0; kk < k; kk += LMAT_BLOCK_K) {
+
+        int kn = k - kk < LMAT_BLOCK_K ? k - kk : LMAT_BLOCK_K;
+
+        for(int jj = 0; jj < n; jj += LMAT_BLOCK_N) {
+
+            int jn = n - jj < LMAT_BLOCK_N ? n - jj : LMAT_BLOCK_N;
+            int i = 0;
+
+            for(; i + 4 <= m; i += 4) {
+
+                double* a0 = a + (long)i * k + kk;
+                int j = 0;
+
+                for(; j + 8 <= jn; j += 8) {
+
+                    double* cp = c + (long)i * n + jj + j;
+                    double* bp = b + (long)kk * n + jj + j;
+
+                    __m256d c00 = _mm256_loadu_pd(cp), c01 = _mm256_loadu_pd(cp + 4);
+                    __m256d c10 = _mm256_loadu_pd(cp + n), c11 = _mm256_loadu_pd(cp + n + 4);
+                    __m256d c20 = _mm256_loadu_pd(cp + 2 * n), c21 = _mm256_loadu_pd(cp + 2 * n + 4);
+                    __m256d c30 = _mm256_loadu_pd(cp + 3 * n), c31 = _mm256_loadu_pd(cp + 3 * n + 4);
+
+                    for(int p = 0; p < kn; p++, bp += n) {
+
+                        __m256d b0 = _mm256_loadu_pd(bp);
+                        __m256d b1 = _mm256_loadu_pd(bp + 4);
+                        __m256d x;
+
+                        x = _mm256_broadcast_sd(a0 + p);
+                        c00 = _mm256_fmadd_pd(x, b0, c00);
+                        c01 = _mm256_fmadd_pd(x, b1, c01);
+                        x = _mm256_broadcast_sd(a0 + k + p);
+                        c10 = _mm256_fmadd_pd(x, b0, c10);
+                        c11 = _mm256_fmadd_pd(x, b1, c11);
+                        x = _mm256_broadcast_sd(a0 + 2 * k + p);
+                        c20 = _mm256_fmadd_pd(x, b0, c20);
+                        c21 = _mm256_fmadd_pd(x, b1, c21);
+                        x = _mm256_broadcast_sd(a0 + 3 * k + p);
+                        c30 = _mm256_fmadd_pd(x, b0, c30);
+                        c31 = _mm256_fmadd_pd(x, b1, c31);
+                    }
+
+                    _mm256_storeu_pd(cp, c00);
+                    _mm256_storeu_pd(cp + 4, c01);
+                    _mm256_storeu_pd(cp + n, c10);
+                    _mm256_storeu_pd(cp + n + 4, c11);
+                    _mm256_storeu_pd(cp + 2 * n, c20);
+                    _mm256_storeu_pd(cp + 2 * n + 4, c21);
+                    _mm256_storeu_pd(cp + 3 * n, c30);
+                    _mm256_storeu_pd(cp + 3 * n + 4, c31);
+                }
+
+                for(; j < jn; j++) {
+                    for(int r = 0; r < 4; r++) {
+                        double sum = 0;
+                        for(int p = 0; p < kn; p++) {
+                            sum += a0[(long)r * k + p] * b[(long)(kk + p) * n + jj + j];
+                        }
+                        c[(long)(i + r) * n + jj + j] += sum;
+                    }
+                }
+            }
+
+            for(; i < m; i++) {
+                double* ci = c + (long)i * n + jj;
+                for(int p = 0; p < kn; p++) {
+                    double aip = a[(long)i * k + kk + p];
+                    double* bp = b + (long)(kk + p) * n + jj;
+                    for(int j = 0; j < jn; j++) {
+                        ci[j] += aip * bp[j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+#endif
+
+lvec_kernels lvec_ops = {
+    lvec_binop_i64_generic, lvec_binop_f64_generic,
+    lvec_sum_i64_generic, lvec_sum_f64_generic,
+    lvec_dot_i64_generic, lvec_dot_f64_generic,
+    lvec_minmax_i64_generic, lvec_minmax_f64_generic,
+    lmat_gemm_f64_generic
+};
+
+void lvec_init(void) {
+
+#if LVEC_X86
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx2")) {
+        lvec_ops.binop_i64 = lvec_binop_i64_avx2;
+        lvec_ops.binop_f64 = lvec_binop_f64_avx2;
+        lvec_ops.sum_i64 = lvec_sum_i64_avx2;
+        lvec_ops.sum_f64 = lvec_sum_f64_avx2;
+        lvec_ops.dot_f64 = lvec_dot_f64_avx2;
+        lvec_ops.minmax_i64 = lvec_minmax_i64_avx2;
+        lvec_ops.minmax_f64 = lvec_minmax_f64_avx2;
+        if(__builtin_cpu_supports("fma")) {
+            lvec_ops.gemm_f64 = lmat_gemm_f64_avx2;
+        }
+    } else if(__builtin_cpu_supports("sse2")) {
+        lvec_ops.binop_i64 = lvec_binop_i64_sse2;
+        lvec_ops.binop_f64 = lvec_binop_f64_sse2;
+        lvec_ops.sum_i64 = lvec_sum_i64_sse2;
+        lvec_ops.sum_f64 = lvec_sum_f64_sse2;
+        lvec_ops.dot_f64 = lvec_dot_f64_sse2;
+        lvec_ops.minmax_f64 = lvec_minmax_f64_sse2;
+    }
+#endif
+}
+
+/*
+ * Dense matrices. Elements are float64, stored row-major in one block, and
+ * like vectors a matrix is immutable and shared from birth. Products go
+ * through the gemm kernel of lvec_ops, split over LMAT_THREADS threads
+ * for large operands when built with -DLMAT_THREADS=n.
+ */
+
+lmat* lmat_new(int rows, int cols) {
+    lmat* x = malloc(sizeof(lmat));
+    x->rows = rows;
+    x->cols = cols;
+    x->data = calloc((long)rows * cols > 0 ? (long)rows * cols : 1, sizeof(double));
+    return x;
+}
+
+void lmat_del(lmat* x) {
+    free(x->data);
+    free(x);
+}
+
+lmat* lmat_copy(lmat* x) {
+    lmat* r = lmat_new(x->rows, x->cols);
+    memcpy(r->data, x->data, sizeof(double) * x->rows * (long)x->cols);
+    return r;
+}
+
+//tile by tile, so both the reads and the writes stay within a few lines
+lmat* lmat_transpose(lmat* x) {
+
+    lmat* r = lmat_new(x->cols, x->rows);
+
+    for(int ii = 0; ii < x->rows; ii += LMAT_BLOCK_T) {
+        for(int jj = 0; jj < x->cols; jj += LMAT_BLOCK_T) {
+            for(int i = ii; i < ii + LMAT_BLOCK_T && i < x->rows; i++) {
+                for(int j = jj; j < jj + LMAT_BLOCK_T && j < x->cols; j++) {
+                    r->data[(long)j * x->rows + i] = x->data[(long)i * x->cols + j];
+                }
+            }
+        }
+    }
+
+    return r;
+}
+
+#ifdef LMAT_THREADS
+
+typedef struct {
+    lmat* r;
+    lmat* x;
+    lmat* y;
+    int from;
+    int to;
+} lmat_part;
+
+void* lmat_mul_part(void* arg) {
+    lmat_part* p = arg;
+    lvec_ops.gemm_f64(p->r->data + (long)p->from * p->r->cols, p->x->data + (long)p->from * p->x->cols,
+            p->y->data, p->to - p->from, p->r->cols, p->x->cols);
+    return NULL;
+}
+
+#endif
+
+//x y, x->cols equals y->rows
+lmat* lmat_mul(lmat* x, lmat* y) {
+
+    lmat* r = lmat_new(x->rows, y->cols);
+
+#ifdef LMAT_THREADS
+    //rows are split evenly, small products are not worth a thread
+    if((double)x->rows * x->cols * y->cols >= 1 << 24 && x->rows >= 2 * LMAT_THREADS) {
+
+        pthread_t threads[LMAT_THREADS];
+        lmat_part parts[LMAT_THREADS];
+        int started[LMAT_THREADS];
+
+        //a part whose thread cannot be started is computed here instead
+        for(int t = 0; t < LMAT_THREADS; t++) {
+            parts[t] = (lmat_part){r, x, y, (long)x->rows * t / LMAT_THREADS, (long)x->rows * (t + 1) / LMAT_THREADS};
+            started[t] = pthread_create(&threads[t], NULL, lmat_mul_part, &parts[t]) == 0;
+            if(!started[t]) {
+                lmat_mul_part(&parts[t]);
+            }
+        }
+        for(int t = 0; t < LMAT_THREADS; t++) {
+            if(started[t]) {
+                pthread_join(threads[t], NULL);
+            }
+        }
+
+        return r;
+    }
+#endif
+
+    lvec_ops.gemm_f64(r->data, x->data, y->data, x->rows, y->cols, x->cols);
+    return r;
+}
+
+//elementwise on equal shapes, numbers are broadcast over every element
+lval* lmat_binop(lval* x, lval* y, char op) {
+
+    int xm = x->type == LVAL_MAT;
+    int ym = y->type == LVAL_MAT;
+
+    ERR_CHECK((x->type != LVAL_BIG && y->type != LVAL_BIG), "Cannot broadcast a bignum over a matrix");
+    ERR_CHECK((!xm || !ym || (x->mat->rows == y->mat->rows && x->mat->cols == y->mat->cols)),
+            "Matrix shapes %dx%d and %dx%d differ", x->mat->rows, x->mat->cols, y->mat->rows, y->mat->cols);
+
+    lmat* shape = xm ? x->mat : y->mat;
+    long n = (long)shape->rows * shape->cols;
+
+    double xv = xm ? 0 : x->type == LVAL_DBL ? x->dbl : (double)x->number;
+    double yv = ym ? 0 : y->type == LVAL_DBL ? y->dbl : (double)y->number;
+    double* xp = xm ? x->mat->data : &xv;
+    double* yp = ym ? y->mat->data : &yv;
+
+    if(op == '/') {
+        for(long i = 0; i < (ym ? n : 1); i++) {
+            ERR_CHECK((yp[i] != 0), "Division with zero");
+        }
+    }
+
+    lmat* r = lmat_new(shape->rows, shape->cols);
+
+    //the kernels count in ints, huge matrices go a row at a time
+    if(n <= INT_MAX) {
+        lvec_ops.binop_f64(r->data, xp, xm, yp, ym, n, op);
+    } else {
+        for(long i = 0; i < shape->rows; i++) {
+            long o = i * shape->cols;
+            lvec_ops.binop_f64(r->data + o, xm ? xp + o : xp, xm, ym ? yp + o : yp, ym, shape->cols, op);
+        }
+    }
+
+    return lval_mat(r);
+}
+
+lenv* lenv_new(void) {
+    lenv* x = malloc(sizeof(lenv));
+    x->count = 0;
+    x->refs = 1;
+    x->par = NULL;
+    x->syms = NULL;
+    x->vals = NULL;
+    return x;
+}
+
+void lenv_del(lenv* v) {
+
+    if(--v->refs) {
+        return;
+    }
+
+    for(int i = 0; i < v->count; i++) {
+        free(v->syms[i]);
+        lval_del(v->vals[i]);
+    }
+    if(v->par) {
+        lenv_del(v->par);
+    }
+    free(v->syms);
+    free(v->vals);
+    free(v);
+}
+
+lenv* lenv_share(lenv* v) {
+    v->refs++;
+    return v;
+}
+
+//a private copy of the bindings of v, sharing its parent
+lenv* lenv_copy(lenv* v) {
+    lenv* x = malloc(sizeof(lenv));
+    x->refs = 1;
+    x->par = v->par ? lenv_share(v->par) : NULL;
+    x->count = v->count;
+    x->syms = malloc(sizeof(char*) * x->count);
+    x->vals = malloc(sizeof(lval*) * x->count);
+
+    for(int i = 0; i < x->count; i++) {
+        x->syms[i] = malloc(strlen(v->syms[i]) + 1);
+        strcpy(x->syms[i], v->syms[i]);
+        x->vals[i] = lval_copy(v->vals[i]);
+    }
+    return x;
+
+}
+
+void lenv_def(lenv* e, lval* k, lval* v) {
+    lenv_def_move(e, lval_copy(k), lval_copy(v));
+}
+
+//like lenv_def, but takes ownership of k and v instead of copying them
+void lenv_def_move(lenv* e, lval* k, lval* v) {
+
+    while(e->par) {
+        e = e->par;
+    }
+
+    lenv_put_move(e, k, v);
+}
+
+lval* lenv_get(lenv* e, lval* v) {
+
+    for(int i = 0; i < e->count; i++) {
+        if(strcmp(e->syms[i], v->sym) == 0) {
+            return lval_copy(e->vals[i]);
+        }
+    }
+
+    if(e->par) {
+        return lenv_get(e->par, v);
+    } else {
+        return lval_err("Unbound Symbol '%s'", v->sym);
+    }
+
+}
+
+void lenv_put(lenv* e, lval* k, lval* v) {
+    lenv_put_move(e, lval_copy(k), lval_copy(v));
+}
+
+//like lenv_put, but takes ownership of k and v instead of copying them
+void lenv_put_move(lenv* e, lval* k, lval* v) {
+
+    v = lval_intern(v);
+
+    for(int i = 0; i < e->count; i++) {
 
         if(strcmp(e->syms[i], k->sym) == 0) {
             lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
+            e->vals[i] = v;
+            lval_del(k);
+            return;
+        }
+    }
+
+    e->count++;
+    e->vals = realloc(e->vals, sizeof(lval*) * e->count);
+    e->syms = realloc(e->syms, sizeof(char*) * e->count);
+
+    e->vals[e->count - 1] = v;
+    e->syms[e->count - 1] = lval_sym_release(k);
+}
+
+//consumes symbol k and returns its name, without a copy when k is not shared
+char* lval_sym_release(lval* k) {
+
+    char* s;
+
+    if(k->refs) {
+        s = malloc(strlen(k->sym) + 1);
+        strcpy(s, k->sym);
+        lval_del(k);
+    } else {
+        s = k->sym;
+        free(k);
+    }
+
+    return s;
+}
+
+lval* builtin_add(lenv* e, largs* a) {
+    return builtin_op(e, a, "+");
+}
+lval* builtin_mul(lenv* e, largs* a) {
+    return builtin_op(e, a, "*");
+}
+lval* builtin_min(lenv* e, largs* a) {
+    return builtin_op(e, a, "-");
+}
+lval* builtin_div(lenv* e, largs* a) {
+    return builtin_op(e, a, "/");
+}
+
+void lenv_add_builtin(lenv* e, char* name, lbuiltin fun) {
+    lenv_put_move(e, lval_sym(name), lval_fun(fun));
+}
+
+void lenv_add_builtins(lenv* e) {
+
+    lenv_add_builtin(e, "list", builtin_list);
+    lenv_add_builtin(e, "head", builtin_head);
+    lenv_add_builtin(e, "tail", builtin_tail);
+    lenv_add_builtin(e, "join", builtin_join);
+    lenv_add_builtin(e, "eval", builtin_eval);
+
+    lenv_add_builtin(e, "+", builtin_add);
+    lenv_add_builtin(e, "-", builtin_min);
+    lenv_add_builtin(e, "/", builtin_div);
+    lenv_add_builtin(e, "*", builtin_mul);
+
+    lenv_add_builtin(e, "sqrt", builtin_sqrt);
+    lenv_add_builtin(e, "exp", builtin_exp);
+    lenv_add_builtin(e, "log", builtin_log);
+    lenv_add_builtin(e, "floor", builtin_floor);
+    lenv_add_builtin(e, "ceil", builtin_ceil);
+
+    lenv_add_builtin(e, "vec", builtin_vec);
+    lenv_add_builtin(e, "fvec", builtin_fvec);
+    lenv_add_builtin(e, "vlist", builtin_vlist);
+    lenv_add_builtin(e, "sum", builtin_sum);
+    lenv_add_builtin(e, "dot", builtin_dot);
+    lenv_add_builtin(e, "min", builtin_vmin);
+    lenv_add_builtin(e, "max", builtin_vmax);
+
+    lenv_add_builtin(e, "mat", builtin_mat);
+    lenv_add_builtin(e, "mlist", builtin_mlist);
+    lenv_add_builtin(e, "mref", builtin_mref);
+    lenv_add_builtin(e, "mdims", builtin_mdims);
+    lenv_add_builtin(e, "transpose", builtin_transpose);
+    lenv_add_builtin(e, "matmul", builtin_matmul);
+
+    lenv_add_builtin(e, "strlen", builtin_strlen);
+    lenv_add_builtin(e, "substr", builtin_substr);
+    lenv_add_builtin(e, "find", builtin_find);
+    lenv_add_builtin(e, "split", builtin_split);
+    lenv_add_builtin(e, "str", builtin_str);
+    lenv_add_builtin(e, "num", builtin_num);
+
+    lenv_add_builtin(e, "get", builtin_get);
+    lenv_add_builtin(e, "assoc", builtin_assoc);
+    lenv_add_builtin(e, "dissoc", builtin_dissoc);
+    lenv_add_builtin(e, "keys", builtin_keys);
+    lenv_add_builtin(e, "vals", builtin_vals);
+
+    lenv_add_builtin(e, "bytes", builtin_bytes);
+    lenv_add_builtin(e, "blen", builtin_blen);
+    lenv_add_builtin(e, "blist", builtin_blist);
+    lenv_add_builtin(e, "slice", builtin_slice);
+    lenv_add_builtin(e, "get-u8", builtin_get_u8);
+    lenv_add_builtin(e, "get-u16le", builtin_get_u16le);
+    lenv_add_builtin(e, "get-u16be", builtin_get_u16be);
+    lenv_add_builtin(e, "get-u32le", builtin_get_u32le);
+    lenv_add_builtin(e, "get-u32be", builtin_get_u32be);
+    lenv_add_builtin(e, "get-u64le", builtin_get_u64le);
+    lenv_add_builtin(e, "get-u64be", builtin_get_u64be);
+    lenv_add_builtin(e, "set-u8", builtin_set_u8);
+    lenv_add_builtin(e, "set-u16le", builtin_set_u16le);
+    lenv_add_builtin(e, "set-u16be", builtin_set_u16be);
+    lenv_add_builtin(e, "set-u32le", builtin_set_u32le);
+    lenv_add_builtin(e, "set-u32be", builtin_set_u32be);
+    lenv_add_builtin(e, "set-u64le", builtin_set_u64le);
+    lenv_add_builtin(e, "set-u64be", builtin_set_u64be);
+    lenv_add_builtin(e, "bread", builtin_bread);
+    lenv_add_builtin(e, "bwrite", builtin_bwrite);
+    lenv_add_builtin(e, "load", builtin_load);
+
+    lenv_add_builtin(e, "range", builtin_range);
+    lenv_add_builtin(e, "map", builtin_map);
+    lenv_add_builtin(e, "filter", builtin_filter);
+    lenv_add_builtin(e, "take", builtin_take);
+    lenv_add_builtin(e, "reduce", builtin_reduce);
+    lenv_add_builtin(e, "collect", builtin_collect);
+
+    lenv_add_builtin(e, "foldl", builtin_foldl);
+    lenv_add_builtin(e, "foldr", builtin_foldr);
+    lenv_add_builtin(e, "len", builtin_len);
+    lenv_add_builtin(e, "nth", builtin_nth);
+    lenv_add_builtin(e, "reverse", builtin_reverse);
+    lenv_add_builtin(e, "sort", builtin_sort);
+    lenv_add_builtin(e, "bsearch", builtin_bsearch);
+
+    lenv_add_builtin(e, "\\", builtin_lambda);
+    lenv_add_builtin(e, "def", builtin_def);
+    lenv_add_builtin(e, "=", builtin_put);
+
+    lenv_add_builtin(e, "==", builtin_eq);
+    lenv_add_builtin(e, "!=", builtin_ne);
+}
+
+lval* lval_add(lval* v, lval* x) {
+    lval_reserve(v, v->count + 1);
+    v->cell[v->count++] = x;
+    return v;
+}
+
+void lval_reserve(lval* v, int n) {
+
+    if(v->offset + n <= v->capacity) {
+        return;
+    }
+
+    lval** base = v->cell - v->offset;
+
+    //slide back over popped slots once they outnumber the live ones
+    if(v->offset && v->offset >= v->count) {
+        memmove(base, v->cell, sizeof(lval*) * v->count);
+        v->cell = base;
+        v->offset = 0;
+        if(n <= v->capacity) {
             return;
         }
     }
 
-    e->count++;
-    e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
+    int capacity = v->capacity ? v->capacity : 4;
+    while(capacity < v->offset + n) {
+        capacity *= 2;
+    }
+
+    base = realloc(base, sizeof(lval*) * capacity);
+    v->cell = base + v->offset;
+    v->capacity = capacity;
+}
+
+lval* lval_read_num(mpc_ast_t* t) {
+    errno = 0;
+    long x = strtol(t->contents, NULL, 10);
+    return errno != ERANGE ? lval_num(x) : lval_big(lbig_read(t->contents));
+}
+
+lval* lval_read_dbl(mpc_ast_t* t) {
+    errno = 0;
+    double x = strtod(t->contents, NULL);
+    return errno != ERANGE ? lval_dbl(x) : lval_err("Invalid Number");
+}
+
+lval* lval_read(mpc_ast_t* t) {
+    if(strstr(t->tag, "decimal")) {
+        return lval_intern(lval_read_dbl(t));
+    }
+    if(strstr(t->tag, "number")) {
+        return lval_intern(lval_read_num(t));
+    }
+    if(strstr(t->tag, "string")) {
+        return lval_intern(lval_read_str(t));
+    }
+    if(strstr(t->tag, "symbol")) {
+        return lval_intern(lval_sym(t->contents));
+    }
+
+    lval* x = NULL;
+    if(strcmp(t->tag, ">") == 0) {
+        x = lval_sexpr();
+    }
+    if(strstr(t->tag, "sexpr")) {
+        x = lval_sexpr();
+    }
+    if(strstr(t->tag, "qexpr") || strstr(t->tag, "map")) {
+        x = lval_qexpr();
+    }
+
+    for(int i = 0; i < t->children_num; i++) {
+        if(strcmp(t->children[i]->contents, "(") == 0) {
+            continue;
+        }
+        if(strcmp(t->children[i]->contents, ")") == 0) {
+            continue;
+        }
+        if(strcmp(t->children[i]->contents, "{") == 0) {
+            continue;
+        }
+        if(strcmp(t->children[i]->contents, "}") == 0) {
+            continue;
+        }
+        if(strcmp(t->children[i]->contents, "[") == 0) {
+            continue;
+        }
+        if(strcmp(t->children[i]->contents, "]") == 0) {
+            continue;
+        }
+        if(strcmp(t->children[i]->tag, "regex") == 0) {
+            continue;
+        }
+        x = lval_add(x, lval_read(t->children[i]));
+    }
+
+    if(strstr(t->tag, "map")) {
+        return lval_read_map(x);
+    }
+
+    return x->type == LVAL_QEXPR ? lval_intern(x) : x;
+}
+
+/*
+ * The reader. Source is scanned once, left to right, and lvals are built
+ * as each token is recognized, following the same grammar as the mpc
+ * parser --mpc falls back to. Open lists are kept on an explicit stack,
+ * so nesting is only bounded by memory, and syntax errors are reported
+ * in mpc's format.
+ */
+
+int lread_is_sym(int c) {
+    return isalnum(c) || (c && strchr("_+-*/\\=<>!&", c));
+}
+
+//-?[0-9]+ or -?[0-9]+\.[0-9]+([eE][-+]?[0-9]+)? at *p, moving *p past it
+lval* lread_num(char** p) {
+
+    char* s = *p;
+    char* q = s + (*s == '-');
+
+    while(isdigit((unsigned char)*q)) {
+        q++;
+    }
+
+    if(*q == '.' && isdigit((unsigned char)q[1])) {
+
+        for(q++; isdigit((unsigned char)*q); q++);
+
+        if(*q == 'e' || *q == 'E') {
+            char* x = q + 1 + (q[1] == '-' || q[1] == '+');
+            if(isdigit((unsigned char)*x)) {
+                for(q = x; isdigit((unsigned char)*q); q++);
+            }
+        }
+
+        *p = q;
+        errno = 0;
+        double d = strtod(s, NULL);
+        return errno != ERANGE ? lval_dbl(d) : lval_err("Invalid Number");
+    }
+
+    *p = q;
+    errno = 0;
+    long x = strtol(s, NULL, 10);
+
+    if(errno != ERANGE) {
+        return lval_num(x);
+    }
+
+    //lbig_read wants the digits on their own
+    char* digits = malloc(q - s + 1);
+    memcpy(digits, s, q - s);
+    digits[q - s] = '\0';
+
+    lval* v = lval_big(lbig_read(digits));
+    free(digits);
+    return v;
+}
+
+//the string literal at *p, NULL when it is not terminated
+lval* lread_str(char** p) {
+
+    char* s = *p + 1;
+    char* q = s;
+    int escaped = 0;
+
+    while(*q && *q != '"') {
+        if(*q == '\\') {
+            escaped = 1;
+            if(!*++q) {
+                break;
+            }
+        }
+        q++;
+    }
+
+    if(!*q) {
+        *p = q;
+        return NULL;
+    }
+
+    *p = q + 1;
+
+    //without escapes the bytes are used as they are
+    if(!escaped) {
+        return lval_str_len(s, q - s);
+    }
+
+    char* raw = malloc(q - s + 1);
+    memcpy(raw, s, q - s);
+    raw[q - s] = '\0';
+
+    raw = mpcf_unescape(raw);
+    lval* v = lval_str(raw);
+    free(raw);
+    return v;
+}
+
+//an mpc style message for a syntax error at the position at in s
+char* lread_error(char* filename, char* s, char* at, char* expected) {
+
+    //lines and columns are only counted once something went wrong
+    int row = 1;
+    int col = 1;
+
+    for(char* c = s; c < at; c++) {
+        if(*c == '\n') {
+            row++;
+            col = 1;
+        } else {
+            col++;
+        }
+    }
+
+    char found[32];
+
+    switch(*at) {
+        case '\0': strcpy(found, "end of input"); break;
+        case '\n': strcpy(found, "newline"); break;
+        case '\t': strcpy(found, "tab"); break;
+        case '\r': strcpy(found, "carriage return"); break;
+        case ' ': strcpy(found, "space"); break;
+        default: snprintf(found, sizeof(found), "'%c'", *at); break;
+    }
+
+    int len = snprintf(NULL, 0, "%s:%i:%i: error: expected %s at %s\n", filename, row, col, expected, found);
+    char* err = malloc(len + 1);
+    snprintf(err, len + 1, "%s:%i:%i: error: expected %s at %s\n", filename, row, col, expected, found);
+    return err;
+}
+
+//reads every expression in s into an S-Expression. On a syntax error
+//returns NULL and leaves a message to free in *err
+lval* lval_read_src(char* filename, char* s, char** err) {
+
+    //open lists and the bracket closing each, the bottom one is s itself
+    int depth = 0;
+    int capacity = 16;
+    lval** open = malloc(sizeof(lval*) * capacity);
+    char* close = malloc(capacity);
+
+    open[0] = lval_sexpr();
+    close[0] = '\0';
+
+    char* p = s;
+    char* int_end = NULL;
+    *err = NULL;
+
+    while(1) {
+
+        while(isspace((unsigned char)*p)) {
+            p++;
+        }
+
+        char c = *p;
+        lval* x;
+
+        if(c == '(' || c == '{' || c == '[') {
+
+            if(++depth == capacity) {
+                capacity *= 2;
+                open = realloc(open, sizeof(lval*) * capacity);
+                close = realloc(close, capacity);
+            }
+
+            open[depth] = c == '(' ? lval_sexpr() : lval_qexpr();
+            close[depth] = c == '(' ? ')' : c == '{' ? '}' : ']';
+            p++;
+            continue;
+        }
+
+        if(c == '\0' || c == ')' || c == '}' || c == ']') {
+
+            if(c != close[depth] || (depth == 0 && open[0]->count == 0)) {
+                break;
+            }
+
+            if(depth == 0) {
+                lval* v = open[0];
+                free(open);
+                free(close);
+                return v;
+            }
+
+            x = open[depth--];
+            p++;
+
+            if(c == ']') {
+                x = lval_read_map(x);
+            } else if(c == '}') {
+                x = lval_intern(x);
+            }
+
+        } else if(c == '"') {
+
+            if(!(x = lread_str(&p))) {
+                *err = lread_error(filename, s, p, "'\"'");
+                break;
+            }
+            x = lval_intern(x);
+
+        } else if(isdigit((unsigned char)c) || (c == '-' && isdigit((unsigned char)p[1]))) {
+
+            x = lval_intern(lread_num(&p));
+            int_end = x->type == LVAL_NUM || x->type == LVAL_BIG ? p : NULL;
+
+        } else if(lread_is_sym(c)) {
+
+            char* q = p;
+            while(lread_is_sym(*q)) {
+                q++;
+            }
+            x = lval_intern(lval_sym_len(p, q - p));
+            p = q;
+
+        } else {
+            break;
+        }
+
+        lval_add(open[depth], x);
+    }
+
+    if(!*err && p == int_end && *p == '.') {
+        //like mpc, blame the missing fraction of a decimal
+        *err = lread_error(filename, s, p + 1, "digit");
+    }
+
+    if(!*err) {
+        char expected[32] = "expression";
+        if(depth) {
+            snprintf(expected, sizeof(expected), "expression or '%c'", close[depth]);
+        } else if(open[0]->count) {
+            strcpy(expected, "expression or end of input");
+        }
+        *err = lread_error(filename, s, p, expected);
+    }
+
+    for(int i = 0; i <= depth; i++) {
+        lval_del(open[i]);
+    }
+    free(open);
+    free(close);
+    return NULL;
+}
+
+//a map literal from its elements read as a Q-Expression
+lval* lval_read_map(lval* x) {
+
+    if(x->count % 2) {
+        lval_del(x);
+        return lval_err("Map literal with an odd number of elements");
+    }
+
+    lval* m = lval_map();
+
+    while(x->count) {
+        lval* k = lval_pop(x, 0);
+        m = lval_map_assoc(m, k, lval_pop(x, 0));
+    }
+
+    lval_del(x);
+    return m;
+}
+
+void lval_print_expr(lval* v, char open, char close) {
+
+    putchar (open);
+
+    for(int i = 0; i < v->count; i++) {
+        lval_print(v->cell[i]);
+
+        if(i != v->count - 1) {
+            putchar(' ');
+        }
+
+    }
+    putchar(close);
+
+}
+
+void lval_println(lval* v) {
+    lval_print(v);
+    putchar('\n');
+}
+
+lval* lval_read_str(mpc_ast_t* t) {
+
+    //drop the quotes and resolve escapes
+    int len = strlen(t->contents);
+    char* unescaped = malloc(len - 1);
+    memcpy(unescaped, t->contents + 1, len - 2);
+    unescaped[len - 2] = '\0';
+
+    unescaped = mpcf_unescape(unescaped);
+    lval* str = lval_str(unescaped);
+    free(unescaped);
+    return str;
+}
+
+void lval_print_dbl(double x) {
+    char buf[32];
+    lval_fmt_dbl(buf, x);
+    printf("%s", buf);
+}
+
+//long buffers are cut short
+void lval_print_bytes(lval* v) {
+
+    printf("#u8(");
+
+    for(long i = 0; i < v->blen && i < 64; i++) {
+        printf(i ? " %d" : "%d", v->bytes->data[v->boff + i]);
+    }
+
+    if(v->blen > 64) {
+        printf(" ... %ld bytes", v->blen);
+    }
+
+    putchar(')');
+}
+
+//rows as vectors, large matrices are cut to their top left corner
+void lval_print_mat(lval* v) {
+
+    lmat* m = v->mat;
+
+    printf("#mat(");
+
+    for(int i = 0; i < m->rows && i < LMAT_PRINT; i++) {
+
+        printf(i ? " <" : "<");
+        for(int j = 0; j < m->cols && j < LMAT_PRINT; j++) {
+            if(j) {
+                putchar(' ');
+            }
+            lval_print_dbl(m->data[(long)i * m->cols + j]);
+        }
+        printf(m->cols > LMAT_PRINT ? " ...>" : ">");
+    }
+
+    if(m->rows > LMAT_PRINT || m->cols > LMAT_PRINT) {
+        printf(" ... %dx%d", m->rows, m->cols);
+    }
+
+    putchar(')');
+}
+
+void lmap_print_entry(lmap_entry* e, void* first) {
+
+    if(!*(int*)first) {
+        putchar(' ');
+    }
+    *(int*)first = 0;
+
+    lval_print(e->key);
+    putchar(' ');
+    lval_print(e->val);
+}
+
+void lval_print_str(lval* v) {
+
+    char* escaped = malloc(v->len + 1);
+    memcpy(escaped, lval_str_data(v), v->len + 1);
+
+    escaped = mpcf_escape(escaped);
+    printf("\"%s\"", escaped);
+    free(escaped);
+}
+
+//shortest form that reads back as the same double, always with a point,
+//buf has room for 32 bytes
+void lval_fmt_dbl(char* buf, double x) {
+
+    for(int precision = 15; precision <= 17; precision++) {
+        snprintf(buf, 32, "%.*g", precision, x);
+        if(strtod(buf, NULL) == x) {
+            break;
+        }
+    }
+
+    if(isfinite(x) && !strpbrk(buf, ".e")) {
+        strcat(buf, ".0");
+    }
+}
+
+void lval_print(lval* v) {
+
+    switch(v->type) {
+        case LVAL_NUM:
+            printf("%ld", v->number);
+            break;
+        case LVAL_DBL:
+            lval_print_dbl(v->dbl);
+            break;
+        case LVAL_BIG: {
+            char* s = lbig_str(v->big);
+            printf("%s", s);
+            free(s);
+            break;
+        }
+        case LVAL_STR:
+            lval_print_str(v);
+            break;
+        case LVAL_BYTES:
+            lval_print_bytes(v);
+            break;
+        case LVAL_SEQ:
+            printf("<sequence>");
+            break;
+        case LVAL_MAP: {
+            int first = 1;
+            putchar('[');
+            lmap_each(v->map, lmap_print_entry, &first);
+            putchar(']');
+            break;
+        }
+        case LVAL_VEC:
+            putchar('<');
+            for(int i = 0; i < v->vec->count; i++) {
+                if(i) {
+                    putchar(' ');
+                }
+                if(v->vec->kind == LVEC_F64) {
+                    lval_print_dbl(v->vec->f[i]);
+                } else {
+                    printf("%lld", (long long)v->vec->i[i]);
+                }
+            }
+            putchar('>');
+            break;
+        case LVAL_MAT:
+            lval_print_mat(v);
+            break;
+        case LVAL_ERR:
+            printf("Error: %s", v->err);
+            break;
+        case LVAL_SYM:
+            printf("%s", v->sym);
+            break;
+        case LVAL_FUN:
+            if(v->fun) {
+                printf("<builtin>");
+            } else {
+                printf("(//");
+                putchar(' ');
+                lval_print(v->formals);
+                putchar(' ');
+                lval_print(v->body);
+                putchar(')');
+            }
+            break;
+        case LVAL_SEXPR:
+            lval_print_expr(v, '(', ')');
+            break;
+        case LVAL_QEXPR:
+            lval_print_expr(v, '{', '}');
+            break;
+    }
+}
+
+lval* lval_eval_sexpr(lenv* e, lval* v) {
+
+    //lambda bodies are frozen, evaluation rewrites the cells in place
+    v = lval_unshare(v);
+
+    for(int i = 0; i < v->count; i++) {
+        v->cell[i] = lval_eval(e, v->cell[i]);
+        if(v->cell[i]->type == LVAL_ERR) {
+            return lval_take(v, i);
+        }
+    }
+
+    if(v->count == 0) {
+        return v;
+    }
+
+    if(v->count == 1) {
+        return lval_take(v, 0);
+    }
+
+    lval* f = v->cell[0];
+
+    if(f->type != LVAL_FUN) {
+        lval_del(v);
+        return lval_err("first argument is not a function");
+    }
+
+    largs args = { v->count - 1, v->cell + 1 };
+    lval* result = lval_call(e, f, &args);
+
+    //delete whatever the builtin left behind
+    for(int i = 0; i < v->count; i++) {
+        if(v->cell[i]) {
+            lval_del(v->cell[i]);
+        }
+    }
+    v->count = 0;
+    lval_del(v);
+
+    return result;
+
+}
+
+lval* lval_eval(lenv* e, lval* v) {
+
+    if(v->type == LVAL_SYM) {
+        lval* x = lenv_get(e, v);
+        lval_del(v);
+        return x;
+    }
+    if(v->type == LVAL_SEXPR) {
+        return lval_eval_sexpr(e, v);
+    }
+    return v;
+}
+
+lval* lval_pop(lval* v, int i) {
+    lval* x = v->cell[i];
+
+    if(i == 0) {
+        v->cell++;
+        v->offset++;
+    } else {
+        memmove(&v->cell[i], &v->cell[i + 1], sizeof(lval*) * (v->count - i - 1));
+    }
+
+    v->count--;
+
+    if(v->count == 0) {
+        v->cell -= v->offset;
+        v->offset = 0;
+    }
+
+    return x;
+
+}
+
+lval* lval_take(lval* v, int i) {
+    lval* x = lval_pop(v, i);
+    lval_del(v);
+    return x;
+}
+
+lval* largs_take(largs* a, int i) {
+    lval* x = a->cell[i];
+    a->cell[i] = NULL;
+    return x;
+}
+
+lval* builtin_op(lenv* e, largs* a, char* op) {
+
+    ERR_CHECK((a->count > 0), "Function %s passed no arguments", op);
+
+    //one pass decides the arithmetic, integers promote to doubles
+    int dbl = 0;
+    int big = 0;
+    int vec = 0;
+    int mat = 0;
+
+    for(int i = 0; i < a->count; i++) {
+        int type = a->cell[i]->type;
+        ERR_CHECK((LVAL_IS_NUMBER(type) || type == LVAL_VEC || type == LVAL_MAT), "Cannot operate on non-numbers");
+        dbl |= (type == LVAL_DBL);
+        big |= (type == LVAL_BIG);
+        vec |= (type == LVAL_VEC);
+        mat |= (type == LVAL_MAT);
+    }
+
+    ERR_CHECK((!vec || !mat), "Cannot mix vectors and matrices");
+
+    if(mat) {
+        return builtin_op_mat(a, op[0]);
+    }
+
+    if(vec) {
+        return builtin_op_vec(a, op[0]);
+    }
+
+    if(dbl) {
+        return builtin_op_dbl(a, op[0]);
+    }
+
+    return big ? builtin_op_big(a, op[0]) : builtin_op_num(a, op[0]);
+}
+
+lval* builtin_op_num(largs* a, char op) {
+
+    long x = a->cell[0]->number;
+    int overflow = 0;
+
+    if(op == '-' && a->count == 1) {
+        overflow = __builtin_sub_overflow(0, x, &x);
+    }
+
+    //on overflow the whole expression is redone with bignums
+    switch(op) {
+        case '+':
+            for(int i = 1; i < a->count && !overflow; i++) {
+                overflow = __builtin_add_overflow(x, a->cell[i]->number, &x);
+            }
+            break;
+        case '-':
+            for(int i = 1; i < a->count && !overflow; i++) {
+                overflow = __builtin_sub_overflow(x, a->cell[i]->number, &x);
+            }
+            break;
+        case '*':
+            for(int i = 1; i < a->count && !overflow; i++) {
+                overflow = __builtin_mul_overflow(x, a->cell[i]->number, &x);
+            }
+            break;
+        case '/':
+            for(int i = 1; i < a->count && !overflow; i++) {
+                if(a->cell[i]->number == 0) {
+                    return lval_err("Division with zero");
+                }
+                if(x == LONG_MIN && a->cell[i]->number == -1) {
+                    overflow = 1;
+                    break;
+                }
+                x /= a->cell[i]->number;
+            }
+            break;
+    }
+
+    return overflow ? builtin_op_big(a, op) : lval_num(x);
+}
+
+lbig* lval_to_big(lval* v) {
+    return v->type == LVAL_BIG ? lbig_copy(v->big) : lbig_from_long(v->number);
+}
+
+lval* builtin_op_big(largs* a, char op) {
+
+    lbig* x = lval_to_big(a->cell[0]);
+
+    if(op == '-' && a->count == 1) {
+        x->neg = x->count ? !x->neg : 0;
+        return lval_big(x);
+    }
+
+    for(int i = 1; i < a->count; i++) {
+
+        lbig* y = lval_to_big(a->cell[i]);
+        lbig* r = NULL;
+
+        switch(op) {
+            case '+': r = lbig_add(x, y); break;
+            case '-': r = lbig_sub(x, y); break;
+            case '*': r = lbig_mul(x, y); break;
+            case '/':
+                if(y->count == 0) {
+                    lbig_del(x);
+                    lbig_del(y);
+                    return lval_err("Division with zero");
+                }
+                r = lbig_div(x, y);
+                break;
+        }
+
+        lbig_del(x);
+        lbig_del(y);
+        x = r;
+    }
+
+    return lval_big(x);
+}
+
+#define LVAL_AS_DBL(v) ((v)->type == LVAL_DBL ? (v)->dbl : \
+        (v)->type == LVAL_BIG ? lbig_to_dbl((v)->big) : (double)(v)->number)
+
+lval* builtin_op_dbl(largs* a, char op) {
+
+    double x = LVAL_AS_DBL(a->cell[0]);
+
+    if(op == '-' && a->count == 1) {
+        return lval_dbl(-x);
+    }
+
+    switch(op) {
+        case '+':
+            for(int i = 1; i < a->count; i++) {
+                x += LVAL_AS_DBL(a->cell[i]);
+            }
+            break;
+        case '-':
+            for(int i = 1; i < a->count; i++) {
+                x -= LVAL_AS_DBL(a->cell[i]);
+            }
+            break;
+        case '*':
+            for(int i = 1; i < a->count; i++) {
+                x *= LVAL_AS_DBL(a->cell[i]);
+            }
+            break;
+        case '/':
+            for(int i = 1; i < a->count; i++) {
+                double y = LVAL_AS_DBL(a->cell[i]);
+                if(y == 0) {
+                    return lval_err("Division with zero");
+                }
+                x /= y;
+            }
+            break;
+    }
+
+    return lval_dbl(x);
+}
+
+lval* builtin_math(lenv* e, largs* a, char* name, double (*f)(double)) {
+
+    ERR_CHECK((a->count == 1), "Function %s passed '%d' arguments, expecting '%d'", name, a->count, 1);
+    ERR_CHECK(LVAL_IS_NUMBER(a->cell[0]->type), "Function %s passed a non-number", name);
+
+    return lval_dbl(f(LVAL_AS_DBL(a->cell[0])));
+}
+
+lval* builtin_sqrt(lenv* e, largs* a) {
+    return builtin_math(e, a, "sqrt", sqrt);
+}
+lval* builtin_exp(lenv* e, largs* a) {
+    return builtin_math(e, a, "exp", exp);
+}
+lval* builtin_log(lenv* e, largs* a) {
+    return builtin_math(e, a, "log", log);
+}
+lval* builtin_floor(lenv* e, largs* a) {
+    return builtin_math(e, a, "floor", floor);
+}
+lval* builtin_ceil(lenv* e, largs* a) {
+    return builtin_math(e, a, "ceil", ceil);
+}
+
+//x op y where at least one side is a vector and the other may be a scalar
+lval* lvec_binop(lval* x, lval* y, char op) {
+
+    int xs = x->type == LVAL_VEC;
+    int ys = y->type == LVAL_VEC;
+
+    if(!xs && !ys) {
+        char name[2] = {op, '\0'};
+        lval* cell[2] = {x, y};
+        largs pair = {2, cell};
+        return builtin_op(NULL, &pair, name);
+    }
+
+    int n = xs ? x->vec->count : y->vec->count;
+
+    ERR_CHECK((!xs || !ys || x->vec->count == y->vec->count), "Vector lengths %d and %d differ", x->vec->count, y->vec->count);
+    ERR_CHECK((x->type != LVAL_BIG && y->type != LVAL_BIG), "Cannot broadcast a bignum over a vector");
+
+    int f64 = x->type == LVAL_DBL || y->type == LVAL_DBL ||
+        (xs && x->vec->kind == LVEC_F64) || (ys && y->vec->kind == LVEC_F64);
+
+    if(!f64) {
+
+        int64_t xv = xs ? 0 : x->number;
+        int64_t yv = ys ? 0 : y->number;
+        int64_t* xp = xs ? x->vec->i : &xv;
+        int64_t* yp = ys ? y->vec->i : &yv;
+
+        if(op == '/') {
+            for(int i = 0; i < (ys ? n : 1); i++) {
+                ERR_CHECK((yp[i] != 0), "Division with zero");
+            }
+        }
+
+        lvec* r = lvec_new(LVEC_I64, n);
+        lvec_ops.binop_i64(r->i, xp, xs, yp, ys, n, op);
+        return lval_vec(r);
+    }
+
+    double xv = 0, yv = 0;
+    double* xt = NULL;
+    double* yt = NULL;
+    double* xp = &xv;
+    double* yp = &yv;
+
+    if(xs) {
+        xp = lvec_f64(x->vec, &xt);
+    } else {
+        xv = x->type == LVAL_DBL ? x->dbl : (double)x->number;
+    }
+
+    if(ys) {
+        yp = lvec_f64(y->vec, &yt);
+    } else {
+        yv = y->type == LVAL_DBL ? y->dbl : (double)y->number;
+    }
+
+    lval* result = NULL;
+
+    if(op == '/') {
+        for(int i = 0; i < (ys ? n : 1); i++) {
+            if(yp[i] == 0) {
+                result = lval_err("Division with zero");
+                break;
+            }
+        }
+    }
+
+    if(!result) {
+        lvec* r = lvec_new(LVEC_F64, n);
+        lvec_ops.binop_f64(r->f, xp, xs, yp, ys, n, op);
+        result = lval_vec(r);
+    }
+
+    free(xt);
+    free(yt);
+    return result;
+}
+
+lval* builtin_op_vec(largs* a, char op) {
+
+    if(op == '-' && a->count == 1) {
+        lval* zero = lval_num(0);
+        lval* r = lvec_binop(zero, a->cell[0], op);
+        lval_del(zero);
+        return r;
+    }
+
+    lval* x = lval_copy(a->cell[0]);
+
+    for(int i = 1; i < a->count && x->type != LVAL_ERR; i++) {
+        lval* r = lvec_binop(x, a->cell[i], op);
+        lval_del(x);
+        x = r;
+    }
+
+    return x;
+}
+
+//(vec 1 2 3) or (vec {1 2 3}), kind -1 picks float64 when any element is a double
+lval* builtin_vec_from(largs* a, char* name, int kind) {
+
+    lval** cell = a->cell;
+    int count = a->count;
+
+    if(count == 1 && cell[0]->type == LVAL_QEXPR) {
+        count = cell[0]->count;
+        cell = cell[0]->cell;
+    }
+
+    int f64 = kind == LVEC_F64;
+
+    for(int i = 0; i < count; i++) {
+        ERR_CHECK((cell[i]->type == LVAL_NUM || cell[i]->type == LVAL_DBL), "Function %s passed a non-number", name);
+        f64 |= cell[i]->type == LVAL_DBL;
+    }
+
+    lvec* r = lvec_new(f64 ? LVEC_F64 : LVEC_I64, count);
+
+    for(int i = 0; i < count; i++) {
+        if(f64) {
+            r->f[i] = cell[i]->type == LVAL_DBL ? cell[i]->dbl : (double)cell[i]->number;
+        } else {
+            r->i[i] = cell[i]->number;
+        }
+    }
+
+    return lval_vec(r);
+}
+
+lval* builtin_vec(lenv* e, largs* a) {
+    return builtin_vec_from(a, "vec", -1);
+}
+
+lval* builtin_fvec(lenv* e, largs* a) {
+    return builtin_vec_from(a, "fvec", LVEC_F64);
+}
+
+lval* builtin_vlist(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 1), "Function vlist passed '%d' arguments, expecting '%d'", a->count, 1);
+    ERR_CHECK((a->cell[0]->type == LVAL_VEC), "Function vlist passed incorrect type");
+
+    lvec* x = a->cell[0]->vec;
+    lval* q = lval_qexpr();
+    lval_reserve(q, x->count);
+
+    for(int i = 0; i < x->count; i++) {
+        q->cell[q->count++] = x->kind == LVEC_F64 ? lval_dbl(x->f[i]) : lval_num(x->i[i]);
+    }
+
+    return q;
+}
+
+lval* builtin_sum(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 1), "Function sum passed '%d' arguments, expecting '%d'", a->count, 1);
+    ERR_CHECK((a->cell[0]->type == LVAL_VEC), "Function sum passed incorrect type");
+
+    lvec* x = a->cell[0]->vec;
+
+    if(x->kind == LVEC_F64) {
+        return lval_dbl(lvec_ops.sum_f64(x->f, x->count));
+    }
+    return lval_num(lvec_ops.sum_i64(x->i, x->count));
+}
+
+lval* builtin_dot(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 2), "Function dot passed '%d' arguments, expecting '%d'", a->count, 2);
+    ERR_CHECK((a->cell[0]->type == LVAL_VEC && a->cell[1]->type == LVAL_VEC), "Function dot passed incorrect type");
+
+    lvec* x = a->cell[0]->vec;
+    lvec* y = a->cell[1]->vec;
+
+    ERR_CHECK((x->count == y->count), "Vector lengths %d and %d differ", x->count, y->count);
+
+    if(x->kind == LVEC_I64 && y->kind == LVEC_I64) {
+        return lval_num(lvec_ops.dot_i64(x->i, y->i, x->count));
+    }
+
+    double* xt;
+    double* yt;
+    double r = lvec_ops.dot_f64(lvec_f64(x, &xt), lvec_f64(y, &yt), x->count);
+
+    free(xt);
+    free(yt);
+    return lval_dbl(r);
+}
+
+lval* builtin_minmax(largs* a, char* name, int max) {
+
+    ERR_CHECK((a->count == 1), "Function %s passed '%d' arguments, expecting '%d'", name, a->count, 1);
+    ERR_CHECK((a->cell[0]->type == LVAL_VEC), "Function %s passed incorrect type", name);
+    ERR_CHECK((a->cell[0]->vec->count > 0), "Function %s passed an empty vector", name);
+
+    lvec* x = a->cell[0]->vec;
+
+    if(x->kind == LVEC_F64) {
+        return lval_dbl(lvec_ops.minmax_f64(x->f, x->count, max));
+    }
+    return lval_num(lvec_ops.minmax_i64(x->i, x->count, max));
+}
+
+lval* builtin_vmin(lenv* e, largs* a) {
+    return builtin_minmax(a, "min", 0);
+}
+
+lval* builtin_vmax(lenv* e, largs* a) {
+    return builtin_minmax(a, "max", 1);
+}
+
+lval* builtin_op_mat(largs* a, char op) {
+
+    if(op == '-' && a->count == 1) {
+        lval* zero = lval_num(0);
+        lval* r = lmat_binop(zero, a->cell[0], op);
+        lval_del(zero);
+        return r;
+    }
+
+    lval* x = lval_copy(a->cell[0]);
+
+    for(int i = 1; i < a->count && x->type != LVAL_ERR; i++) {
+        lval* r = lmat_binop(x, a->cell[i], op);
+        lval_del(x);
+        x = r;
+    }
+
+    return x;
+}
+
+//(mat {{1 2} {3 4}}) from rows of numbers or vectors, (mat rows cols) of zeros
+lval* builtin_mat(lenv* e, largs* a) {
+
+    if(a->count == 2) {
+        ERR_CHECK((a->cell[0]->type == LVAL_NUM && a->cell[1]->type == LVAL_NUM), "Function mat passed incorrect type");
+        ERR_CHECK((a->cell[0]->number >= 0 && a->cell[1]->number >= 0 && a->cell[0]->number <= INT_MAX && a->cell[1]->number <= INT_MAX),
+                "Function mat passed a bad shape");
+        return lval_mat(lmat_new(a->cell[0]->number, a->cell[1]->number));
+    }
+
+    ERR_CHECK((a->count == 1), "Function mat passed '%d' arguments, expecting '%d' or '%d'", a->count, 1, 2);
+    ERR_CHECK((a->cell[0]->type == LVAL_QEXPR), "Function mat passed incorrect type");
+
+    lval* q = a->cell[0];
+    int cols = 0;
+
+    for(int i = 0; i < q->count; i++) {
+
+        lval* row = q->cell[i];
+        ERR_CHECK((row->type == LVAL_QEXPR || row->type == LVAL_VEC), "Function mat passed a row that is not a list");
+
+        int n = row->type == LVAL_VEC ? row->vec->count : row->count;
+        ERR_CHECK((i == 0 || n == cols), "Function mat passed rows of different lengths");
+        cols = n;
+
+        for(int j = 0; row->type == LVAL_QEXPR && j < n; j++) {
+            ERR_CHECK((row->cell[j]->type == LVAL_NUM || row->cell[j]->type == LVAL_DBL), "Function mat passed a non-number");
+        }
+    }
+
+    lmat* m = lmat_new(q->count, cols);
+
+    for(int i = 0; i < q->count; i++) {
+
+        lval* row = q->cell[i];
+        double* out = m->data + (long)i * cols;
+
+        if(row->type == LVAL_VEC) {
+            double* tmp;
+            memcpy(out, lvec_f64(row->vec, &tmp), sizeof(double) * cols);
+            free(tmp);
+            continue;
+        }
+
+        for(int j = 0; j < cols; j++) {
+            out[j] = LVAL_AS_DBL(row->cell[j]);
+        }
+    }
+
+    return lval_mat(m);
+}
+
+lval* builtin_mlist(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 1), "Function mlist passed '%d' arguments, expecting '%d'", a->count, 1);
+    ERR_CHECK((a->cell[0]->type == LVAL_MAT), "Function mlist passed incorrect type");
+
+    lmat* m = a->cell[0]->mat;
+    lval* q = lval_qexpr();
+    lval_reserve(q, m->rows);
+
+    for(int i = 0; i < m->rows; i++) {
+
+        lval* row = lval_qexpr();
+        lval_reserve(row, m->cols);
+
+        for(int j = 0; j < m->cols; j++) {
+            row->cell[row->count++] = lval_dbl(m->data[(long)i * m->cols + j]);
+        }
+        q->cell[q->count++] = row;
+    }
+
+    return q;
+}
+
+lval* builtin_mref(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 3), "Function mref passed '%d' arguments, expecting '%d'", a->count, 3);
+    ERR_CHECK((a->cell[0]->type == LVAL_MAT && a->cell[1]->type == LVAL_NUM && a->cell[2]->type == LVAL_NUM),
+            "Function mref passed incorrect type");
+
+    lmat* m = a->cell[0]->mat;
+    long i = a->cell[1]->number;
+    long j = a->cell[2]->number;
+
+    ERR_CHECK((i >= 0 && i < m->rows && j >= 0 && j < m->cols), "Function mref passed index %ld %ld out of range", i, j);
+
+    return lval_dbl(m->data[i * m->cols + j]);
+}
+
+lval* builtin_mdims(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 1), "Function mdims passed '%d' arguments, expecting '%d'", a->count, 1);
+    ERR_CHECK((a->cell[0]->type == LVAL_MAT), "Function mdims passed incorrect type");
+
+    lval* q = lval_qexpr();
+    lval_add(q, lval_num(a->cell[0]->mat->rows));
+    lval_add(q, lval_num(a->cell[0]->mat->cols));
+    return q;
+}
+
+lval* builtin_transpose(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 1), "Function transpose passed '%d' arguments, expecting '%d'", a->count, 1);
+    ERR_CHECK((a->cell[0]->type == LVAL_MAT), "Function transpose passed incorrect type");
+
+    return lval_mat(lmat_transpose(a->cell[0]->mat));
+}
+
+lval* builtin_matmul(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 2), "Function matmul passed '%d' arguments, expecting '%d'", a->count, 2);
+    ERR_CHECK((a->cell[0]->type == LVAL_MAT && a->cell[1]->type == LVAL_MAT), "Function matmul passed incorrect type");
+
+    lmat* x = a->cell[0]->mat;
+    lmat* y = a->cell[1]->mat;
+
+    ERR_CHECK((x->cols == y->rows), "Cannot multiply a %dx%d matrix by a %dx%d one", x->rows, x->cols, y->rows, y->cols);
+
+    return lval_mat(lmat_mul(x, y));
+}
+
+lval* builtin_strlen(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 1), "Function strlen passed '%d' arguments, expecting '%d'", a->count, 1);
+    ERR_CHECK((a->cell[0]->type == LVAL_STR), "Function strlen passed incorrect type");
+
+    return lval_num(a->cell[0]->len);
+}
+
+lval* builtin_substr(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 3), "Function substr passed '%d' arguments, expecting '%d'", a->count, 3);
+    ERR_CHECK((a->cell[0]->type == LVAL_STR && a->cell[1]->type == LVAL_NUM && a->cell[2]->type == LVAL_NUM),
+            "Function substr passed incorrect types");
+
+    long start = a->cell[1]->number;
+    long count = a->cell[2]->number;
+    int len = a->cell[0]->len;
+
+    ERR_CHECK((start >= 0 && count >= 0 && start <= len && count <= len - start),
+            "Function substr passed range %ld+%ld outside a string of length %d", start, count, len);
+
+    return lval_str_len(lval_str_data(a->cell[0]) + start, count);
+}
+
+lval* builtin_find(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 2), "Function find passed '%d' arguments, expecting '%d'", a->count, 2);
+    ERR_CHECK((a->cell[0]->type == LVAL_STR && a->cell[1]->type == LVAL_STR), "Function find passed incorrect types");
+
+    lval* s = a->cell[0];
+    lval* n = a->cell[1];
+
+    return lval_num(lstr_find(lval_str_data(s), s->len, lval_str_data(n), n->len, 0));
+}
+
+lval* builtin_split(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 2), "Function split passed '%d' arguments, expecting '%d'", a->count, 2);
+    ERR_CHECK((a->cell[0]->type == LVAL_STR && a->cell[1]->type == LVAL_STR), "Function split passed incorrect types");
+    ERR_CHECK((a->cell[1]->len > 0), "Function split passed an empty separator");
+
+    char* s = lval_str_data(a->cell[0]);
+    char* sep = lval_str_data(a->cell[1]);
+    int len = a->cell[0]->len;
+    int seplen = a->cell[1]->len;
+
+    lval* q = lval_qexpr();
+    int from = 0;
+
+    while(1) {
+        int at = lstr_find(s, len, sep, seplen, from);
+        if(at < 0) {
+            break;
+        }
+        lval_add(q, lval_str_len(s + from, at - from));
+        from = at + seplen;
+    }
+
+    return lval_add(q, lval_str_len(s + from, len - from));
+}
+
+lval* builtin_str(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 1), "Function str passed '%d' arguments, expecting '%d'", a->count, 1);
+
+    lval* x = a->cell[0];
+    char buf[32];
+
+    switch(x->type) {
+        case LVAL_STR:
+            return largs_take(a, 0);
+        case LVAL_NUM:
+            snprintf(buf, sizeof(buf), "%ld", x->number);
+            return lval_str(buf);
+        case LVAL_DBL:
+            lval_fmt_dbl(buf, x->dbl);
+            return lval_str(buf);
+        case LVAL_BIG: {
+            char* s = lbig_str(x->big);
+            lval* v = lval_str(s);
+            free(s);
+            return v;
+        }
+    }
+
+    return lval_err("Function str passed incorrect type");
+}
+
+lval* builtin_num(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 1), "Function num passed '%d' arguments, expecting '%d'", a->count, 1);
+    ERR_CHECK((a->cell[0]->type == LVAL_STR), "Function num passed incorrect type");
+
+    char* s = lval_str_data(a->cell[0]);
+    char* digits = s + (*s == '-');
+
+    //integers read like literals do, overflowing into bignums
+    if(*digits && strspn(digits, "0123456789") == strlen(digits)) {
+        errno = 0;
+        long x = strtol(s, NULL, 10);
+        return errno != ERANGE ? lval_num(x) : lval_big(lbig_read(s));
+    }
+
+    char* end;
+    double d = strtod(s, &end);
+
+    ERR_CHECK((end != s && *end == '\0' && !isspace((unsigned char)*s)), "Function num passed \"%s\", not a number", s);
+
+    return lval_dbl(d);
+}
+
+//adopts k and v
+lval* lval_map_assoc(lval* m, lval* k, lval* v) {
+
+    lmap_entry e = {lval_hash(k), lval_freeze(k), lval_freeze(v)};
+    int added;
+
+    lmap* r = lmap_assoc(m->map, e, 0, &added);
+    lmap_del(m->map);
+    m->map = r;
+    return m;
+}
+
+void lmap_add_key(lmap_entry* e, void* q) {
+    lval_add(q, lval_copy(e->key));
+}
+
+void lmap_add_val(lmap_entry* e, void* q) {
+    lval_add(q, lval_copy(e->val));
+}
+
+lval* builtin_get(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 2 || a->count == 3), "Function get passed '%d' arguments, expecting '%d' or '%d'", a->count, 2, 3);
+    ERR_CHECK((a->cell[0]->type == LVAL_MAP), "Function get passed incorrect type");
+
+    lval* v = lmap_get(a->cell[0]->map, a->cell[1], lval_hash(a->cell[1]));
+
+    if(v) {
+        return lval_copy(v);
+    }
+
+    //an optional third argument is the default for missing keys
+    ERR_CHECK((a->count == 3), "Function get passed a key not in the map");
+    return largs_take(a, 2);
+}
+
+lval* builtin_assoc(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count % 2 == 1), "Function assoc passed '%d' arguments, expecting a map and key value pairs", a->count);
+    ERR_CHECK((a->cell[0]->type == LVAL_MAP), "Function assoc passed incorrect type");
+
+    lval* m = lval_unshare(largs_take(a, 0));
+
+    for(int i = 1; i < a->count; i += 2) {
+        m = lval_map_assoc(m, largs_take(a, i), largs_take(a, i + 1));
+    }
+
+    return m;
+}
+
+lval* builtin_dissoc(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count > 0), "Function dissoc passed no arguments");
+    ERR_CHECK((a->cell[0]->type == LVAL_MAP), "Function dissoc passed incorrect type");
+
+    lval* m = lval_unshare(largs_take(a, 0));
+
+    for(int i = 1; i < a->count; i++) {
+        int removed;
+        lmap* r = lmap_dissoc(m->map, a->cell[i], lval_hash(a->cell[i]), 0, &removed);
+        lmap_del(m->map);
+        m->map = r;
+    }
+
+    return m;
+}
+
+lval* builtin_keys(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 1), "Function keys passed '%d' arguments, expecting '%d'", a->count, 1);
+    ERR_CHECK((a->cell[0]->type == LVAL_MAP), "Function keys passed incorrect type");
+
+    lval* q = lval_qexpr();
+    lval_reserve(q, lval_map_size(a->cell[0]));
+    lmap_each(a->cell[0]->map, lmap_add_key, q);
+    return q;
+}
+
+lval* builtin_vals(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 1), "Function vals passed '%d' arguments, expecting '%d'", a->count, 1);
+    ERR_CHECK((a->cell[0]->type == LVAL_MAP), "Function vals passed incorrect type");
+
+    lval* q = lval_qexpr();
+    lval_reserve(q, lval_map_size(a->cell[0]));
+    lmap_each(a->cell[0]->map, lmap_add_val, q);
+    return q;
+}
+
+lval* builtin_bytes(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 1), "Function bytes passed '%d' arguments, expecting '%d'", a->count, 1);
+
+    lval* x = a->cell[0];
+
+    if(x->type == LVAL_NUM) {
+        ERR_CHECK((x->number >= 0), "Function bytes passed a negative size");
+        lval* v = lval_bytes(x->number);
+        ERR_CHECK(v, "Function bytes could not allocate %ld bytes", x->number);
+        memset(v->bytes->data, 0, x->number);
+        return v;
+    }
+
+    ERR_CHECK((x->type == LVAL_QEXPR), "Function bytes passed incorrect type");
+
+    for(int i = 0; i < x->count; i++) {
+        ERR_CHECK((x->cell[i]->type == LVAL_NUM && x->cell[i]->number >= 0 && x->cell[i]->number <= 255),
+                "Function bytes passed an element that is not a byte");
+    }
+
+    lval* v = lval_bytes(x->count);
+    for(int i = 0; i < x->count; i++) {
+        v->bytes->data[i] = (unsigned char)x->cell[i]->number;
+    }
+    return v;
+}
+
+lval* builtin_blen(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 1), "Function blen passed '%d' arguments, expecting '%d'", a->count, 1);
+    ERR_CHECK((a->cell[0]->type == LVAL_BYTES), "Function blen passed incorrect type");
+
+    return lval_num(a->cell[0]->blen);
+}
+
+lval* builtin_blist(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 1), "Function blist passed '%d' arguments, expecting '%d'", a->count, 1);
+    ERR_CHECK((a->cell[0]->type == LVAL_BYTES), "Function blist passed incorrect type");
+
+    lval* b = a->cell[0];
+    lval* q = lval_qexpr();
+    lval_reserve(q, b->blen);
+
+    for(long i = 0; i < b->blen; i++) {
+        q->cell[q->count++] = lval_num(b->bytes->data[b->boff + i]);
+    }
+
+    return q;
+}
+
+//a view of part of the same buffer, nothing is copied
+lval* builtin_slice(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 3), "Function slice passed '%d' arguments, expecting '%d'", a->count, 3);
+    ERR_CHECK((a->cell[0]->type == LVAL_BYTES && a->cell[1]->type == LVAL_NUM && a->cell[2]->type == LVAL_NUM),
+            "Function slice passed incorrect types");
+
+    lval* b = a->cell[0];
+    long off = a->cell[1]->number;
+    long len = a->cell[2]->number;
+
+    ERR_CHECK((off >= 0 && len >= 0 && off <= b->blen && len <= b->blen - off),
+            "Function slice passed range %ld+%ld outside %ld bytes", off, len, b->blen);
+
+    lval* v = lval_copy(b);
+    v->boff += off;
+    v->blen = len;
+    return v;
+}
+
+lval* builtin_bget(largs* a, char* name, int width, int big_endian) {
+
+    ERR_CHECK((a->count == 2), "Function %s passed '%d' arguments, expecting '%d'", name, a->count, 2);
+    ERR_CHECK((a->cell[0]->type == LVAL_BYTES && a->cell[1]->type == LVAL_NUM), "Function %s passed incorrect types", name);
+
+    lval* b = a->cell[0];
+    long off = a->cell[1]->number;
+
+    ERR_CHECK((off >= 0 && off <= b->blen - width), "Function %s passed offset %ld outside %ld bytes", name, off, b->blen);
+
+    uint64_t x = lbytes_load(b->bytes->data + b->boff + off, width, big_endian);
+
+    //u64 values past LONG_MAX come back as bignums
+    if(x > LONG_MAX) {
+        return lval_big(lbig_from_u64(x));
+    }
+
+    return lval_num((long)x);
+}
+
+lval* builtin_bset(largs* a, char* name, int width, int big_endian) {
+
+    ERR_CHECK((a->count == 3), "Function %s passed '%d' arguments, expecting '%d'", name, a->count, 3);
+    ERR_CHECK((a->cell[0]->type == LVAL_BYTES && a->cell[1]->type == LVAL_NUM), "Function %s passed incorrect types", name);
+
+    lval* b = a->cell[0];
+    lval* v = a->cell[2];
+    long off = a->cell[1]->number;
+    uint64_t x;
+
+    ERR_CHECK((off >= 0 && off <= b->blen - width), "Function %s passed offset %ld outside %ld bytes", name, off, b->blen);
+
+    if(v->type == LVAL_BIG) {
+        ERR_CHECK((!v->big->neg && v->big->count <= 64 / LBIG_BITS && width == 8), "Function %s passed a value that does not fit", name);
+        x = lbig_to_u64(v->big);
+    } else {
+        ERR_CHECK((v->type == LVAL_NUM), "Function %s passed incorrect types", name);
+        ERR_CHECK((v->number >= 0 && (width == 8 || (uint64_t)v->number >> (width * 8) == 0)),
+                "Function %s passed a value that does not fit", name);
+        x = (uint64_t)v->number;
+    }
+
+    //writes copy the window first if any other value or slice still sees
+    //the buffer, so byte vectors keep value semantics like everything else
+    b = lval_unshare(largs_take(a, 0));
+
+    if(b->bytes->refs > 1) {
+        lbytes* c = malloc(sizeof(lbytes) + (b->blen > 0 ? b->blen : 1));
+        c->refs = 1;
+        memcpy(c->data, b->bytes->data + b->boff, b->blen);
+        lbytes_del(b->bytes);
+        b->bytes = c;
+        b->boff = 0;
+    }
+
+    lbytes_store(b->bytes->data + b->boff + off, width, big_endian, x);
+    return b;
+}
+
+lval* builtin_get_u8(lenv* e, largs* a) {
+    return builtin_bget(a, "get-u8", 1, 0);
+}
+
+lval* builtin_get_u16le(lenv* e, largs* a) {
+    return builtin_bget(a, "get-u16le", 2, 0);
+}
+
+lval* builtin_get_u16be(lenv* e, largs* a) {
+    return builtin_bget(a, "get-u16be", 2, 1);
+}
+
+lval* builtin_get_u32le(lenv* e, largs* a) {
+    return builtin_bget(a, "get-u32le", 4, 0);
+}
+
+lval* builtin_get_u32be(lenv* e, largs* a) {
+    return builtin_bget(a, "get-u32be", 4, 1);
+}
+
+lval* builtin_get_u64le(lenv* e, largs* a) {
+    return builtin_bget(a, "get-u64le", 8, 0);
+}
+
+lval* builtin_get_u64be(lenv* e, largs* a) {
+    return builtin_bget(a, "get-u64be", 8, 1);
+}
+
+lval* builtin_set_u8(lenv* e, largs* a) {
+    return builtin_bset(a, "set-u8", 1, 0);
+}
+
+lval* builtin_set_u16le(lenv* e, largs* a) {
+    return builtin_bset(a, "set-u16le", 2, 0);
+}
+
+lval* builtin_set_u16be(lenv* e, largs* a) {
+    return builtin_bset(a, "set-u16be", 2, 1);
+}
+
+lval* builtin_set_u32le(lenv* e, largs* a) {
+    return builtin_bset(a, "set-u32le", 4, 0);
+}
+
+lval* builtin_set_u32be(lenv* e, largs* a) {
+    return builtin_bset(a, "set-u32be", 4, 1);
+}
+
+lval* builtin_set_u64le(lenv* e, largs* a) {
+    return builtin_bset(a, "set-u64le", 8, 0);
+}
+
+lval* builtin_set_u64be(lenv* e, largs* a) {
+    return builtin_bset(a, "set-u64be", 8, 1);
+}
+
+//(bread path) reads a whole file, (bread path off len) a range of it
+lval* builtin_bread(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 1 || a->count == 3), "Function bread passed '%d' arguments, expecting '%d' or '%d'", a->count, 1, 3);
+    ERR_CHECK((a->cell[0]->type == LVAL_STR), "Function bread passed incorrect types");
+
+    long off = 0;
+    long len = -1;
+
+    if(a->count == 3) {
+        ERR_CHECK((a->cell[1]->type == LVAL_NUM && a->cell[2]->type == LVAL_NUM), "Function bread passed incorrect types");
+        off = a->cell[1]->number;
+        len = a->cell[2]->number;
+        ERR_CHECK((off >= 0 && len >= 0), "Function bread passed a negative range");
+    }
+
+    char* path = lval_str_data(a->cell[0]);
+    FILE* f = fopen(path, "rb");
+
+    ERR_CHECK(f, "Could not open '%s': %s", path, strerror(errno));
+
+    //the range is clamped to the file, so a long one only reads what exists
+    long size = fseek(f, 0, SEEK_END) == 0 ? ftell(f) : -1;
+    long avail = size > off ? size - off : 0;
+
+    if(len < 0 || (size >= 0 && len > avail)) {
+        len = avail;
+    }
+
+    lval* v = lval_bytes(len);
+
+    if(!v) {
+        fclose(f);
+        return lval_err("Function bread could not allocate %ld bytes", len);
+    }
+
+    if(fseek(f, off, SEEK_SET) != 0) {
+        v->blen = 0;
+    } else {
+        v->blen = fread(v->bytes->data, 1, len, f);
+    }
+
+    int failed = ferror(f);
+    fclose(f);
+
+    if(failed) {
+        lval_del(v);
+        return lval_err("Could not read '%s'", path);
+    }
+
+    return v;
+}
+
+//(load path) evaluates every expression in a file, printing any errors
+lval* builtin_load(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 1), "Function load passed '%d' arguments, expecting '%d'", a->count, 1);
+    ERR_CHECK((a->cell[0]->type == LVAL_STR), "Function load passed incorrect type");
+
+    char* path = lval_str_data(a->cell[0]);
+    FILE* f = fopen(path, "rb");
+
+    ERR_CHECK(f, "Could not open '%s': %s", path, strerror(errno));
+
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char* src = malloc(len > 0 ? len + 1 : 1);
+    len = len > 0 ? fread(src, 1, len, f) : 0;
+    src[len] = '\0';
+    fclose(f);
+
+    char* err;
+    lval* x = lval_read_src(path, src, &err);
+    free(src);
+
+    if(!x) {
+        //mpc style messages end in a newline an lval error does not need
+        err[strlen(err) - 1] = '\0';
+        lval* v = lval_err("%s", err);
+        free(err);
+        return v;
+    }
+
+    while(x->count) {
+        lval* r = lval_eval(e, lval_pop(x, 0));
+        if(r->type == LVAL_ERR) {
+            lval_println(r);
+        }
+        lval_del(r);
+    }
+
+    lval_del(x);
+    return lval_sexpr();
+}
+
+//(bwrite b path) replaces a file, (bwrite b path off) writes into it at off
+lval* builtin_bwrite(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 2 || a->count == 3), "Function bwrite passed '%d' arguments, expecting '%d' or '%d'", a->count, 2, 3);
+    ERR_CHECK((a->cell[0]->type == LVAL_BYTES && a->cell[1]->type == LVAL_STR), "Function bwrite passed incorrect types");
+
+    lval* b = a->cell[0];
+    char* path = lval_str_data(a->cell[1]);
+    long off = 0;
+    FILE* f;
+
+    if(a->count == 3) {
+        ERR_CHECK((a->cell[2]->type == LVAL_NUM && a->cell[2]->number >= 0), "Function bwrite passed incorrect types");
+        off = a->cell[2]->number;
+        f = fopen(path, "r+b");
+        if(!f && errno == ENOENT) {
+            f = fopen(path, "w+b");
+        }
+    } else {
+        f = fopen(path, "wb");
+    }
+
+    ERR_CHECK(f, "Could not open '%s': %s", path, strerror(errno));
+
+    long n = 0;
+    if(fseek(f, off, SEEK_SET) == 0) {
+        n = fwrite(b->bytes->data + b->boff, 1, b->blen, f);
+    }
+
+    if(fclose(f) != 0 || n != b->blen) {
+        return lval_err("Could not write '%s'", path);
+    }
 
-    e->vals[e->count - 1] = lval_copy(v);
-    e->syms[e->count - 1] = malloc(strlen(k->sym) + 1);
-    strcpy(e->syms[e->count - 1], k->sym);
+    return lval_num(n);
 }
 
-lval* builtin_add(lenv* e, lval* a) {
-    return builtin_op(e, a, "+");
+//calls f on count arguments, taking ownership of them
+lval* lval_apply(lenv* e, lval* f, int count, lval** cell) {
+
+    largs a = {count, cell};
+    lval* r = lval_call(e, f, &a);
+
+    for(int i = 0; i < count; i++) {
+        if(cell[i]) {
+            lval_del(cell[i]);
+        }
+    }
+
+    return r;
 }
-lval* builtin_mul(lenv* e, lval* a) {
-    return builtin_op(e, a, "*");
+
+//anything but the number 0 is true
+int lval_truthy(lval* v) {
+    return !(v->type == LVAL_NUM && v->number == 0);
 }
-lval* builtin_min(lenv* e, lval* a) {
-    return builtin_op(e, a, "-");
+
+lval* lval_seq(lseq* s) {
+    lval* v = malloc(sizeof(lval));
+    v->type = LVAL_SEQ;
+    v->seq = s;
+    v->refs = 0;
+    return v;
 }
-lval* builtin_div(lenv* e, lval* a) {
-    return builtin_op(e, a, "/");
+
+//the sequence behind v, Q-Expressions become a source stage over their
+//elements. NULL when v is neither
+lseq* lval_to_seq(lval* v) {
+
+    if(v->type == LVAL_SEQ) {
+        return lseq_share(v->seq);
+    }
+
+    if(v->type != LVAL_QEXPR) {
+        return NULL;
+    }
+
+    lseq* s = lseq_new(LSEQ_LIST, NULL);
+    s->fn = lval_freeze(lval_copy(v));
+    return s;
 }
 
-void lenv_add_builtin(lenv* e, char* name, lbuiltin fun) {
-    lval* k = lval_sym(name);
-    lval* f = lval_fun(fun);
-    lenv_put(e, k, f);
-    lval_del(k);
-    lval_del(f);
+lval* builtin_range(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count >= 1 && a->count <= 3), "Function range passed '%d' arguments, expecting '%d' to '%d'", a->count, 1, 3);
+
+    for(int i = 0; i < a->count; i++) {
+        ERR_CHECK((a->cell[i]->type == LVAL_NUM), "Function range passed incorrect type");
+    }
+
+    lseq* s = lseq_new(LSEQ_RANGE, NULL);
+
+    //(range end), (range start end) or (range start end step)
+    if(a->count == 1) {
+        s->end = a->cell[0]->number;
+    } else {
+        s->start = a->cell[0]->number;
+        s->end = a->cell[1]->number;
+    }
+
+    if(a->count == 3) {
+        s->step = a->cell[2]->number;
+        if(s->step == 0) {
+            lseq_del(s);
+            return lval_err("Function range passed a step of 0");
+        }
+    }
+
+    return lval_seq(s);
 }
 
-void lenv_add_builtins(lenv* e) {
+lval* builtin_stage(largs* a, char* name, int kind) {
 
-    lenv_add_builtin(e, "list", builtin_list);
-    lenv_add_builtin(e, "head", builtin_head);
-    lenv_add_builtin(e, "tail", builtin_tail);
-    lenv_add_builtin(e, "join", builtin_join);
-    lenv_add_builtin(e, "eval", builtin_eval);
+    ERR_CHECK((a->count == 2), "Function %s passed '%d' arguments, expecting '%d'", name, a->count, 2);
+    ERR_CHECK((a->cell[0]->type == LVAL_FUN), "Function %s passed incorrect type", name);
 
-    lenv_add_builtin(e, "+", builtin_add);
-    lenv_add_builtin(e, "-", builtin_min);
-    lenv_add_builtin(e, "/", builtin_div);
-    lenv_add_builtin(e, "*", builtin_mul);
+    lseq* src = lval_to_seq(a->cell[1]);
+    ERR_CHECK(src, "Function %s passed incorrect type", name);
 
-    lenv_add_builtin(e, "def", builtin_def);
-    lenv_add_builtin(e, "=", builtin_put);
+    lseq* s = lseq_new(kind, src);
+    s->fn = lval_freeze(largs_take(a, 0));
+    return lval_seq(s);
+}
+
+//Q-Expressions are mapped eagerly, anything else becomes a lazy stage
+lval* builtin_map(lenv* e, largs* a) {
+
+    if(a->count == 2 && a->cell[1]->type == LVAL_QEXPR) {
+        return builtin_each(e, a, "map", 0);
+    }
+
+    return builtin_stage(a, "map", LSEQ_MAP);
+}
+
+lval* builtin_filter(lenv* e, largs* a) {
+
+    if(a->count == 2 && a->cell[1]->type == LVAL_QEXPR) {
+        return builtin_each(e, a, "filter", 1);
+    }
+
+    return builtin_stage(a, "filter", LSEQ_FILTER);
+}
+
+lval* builtin_take(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 2), "Function take passed '%d' arguments, expecting '%d'", a->count, 2);
+    ERR_CHECK((a->cell[0]->type == LVAL_NUM && a->cell[0]->number >= 0), "Function take passed incorrect type");
+
+    long n = a->cell[0]->number;
+    lseq* src = lval_to_seq(a->cell[1]);
+    ERR_CHECK(src, "Function take passed incorrect type");
+
+    //take of a take keeps the smaller count
+    if(src->kind == LSEQ_TAKE) {
+        lseq* inner = lseq_share(src->src);
+        n = n < src->end ? n : src->end;
+        lseq_del(src);
+        src = inner;
+    }
+
+    lseq* s = lseq_new(LSEQ_TAKE, src);
+    s->end = n;
+    return lval_seq(s);
+}
+
+lval* builtin_reduce(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 3), "Function reduce passed '%d' arguments, expecting '%d'", a->count, 3);
+    ERR_CHECK((a->cell[0]->type == LVAL_FUN), "Function reduce passed incorrect type");
+
+    lseq* s = lval_to_seq(a->cell[2]);
+    ERR_CHECK(s, "Function reduce passed incorrect type");
+
+    lval* f = a->cell[0];
+    lval* acc = largs_take(a, 1);
+    lseq_iter* it = lseq_iter_new(s);
+    lval* x;
+
+    while(acc->type != LVAL_ERR && (x = lseq_next(e, it))) {
+
+        if(x->type == LVAL_ERR) {
+            lval_del(acc);
+            acc = x;
+            break;
+        }
+
+        lval* pair[2] = {acc, x};
+        acc = lval_apply(e, f, 2, pair);
+    }
+
+    lseq_iter_del(it);
+    lseq_del(s);
+    return acc;
+}
+
+//runs a sequence into a Q-Expression
+lval* builtin_collect(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 1), "Function collect passed '%d' arguments, expecting '%d'", a->count, 1);
+
+    lseq* s = lval_to_seq(a->cell[0]);
+    ERR_CHECK(s, "Function collect passed incorrect type");
+
+    lval* q = lval_qexpr();
+    lseq_iter* it = lseq_iter_new(s);
+    lval* x;
+
+    while((x = lseq_next(e, it))) {
+        if(x->type == LVAL_ERR) {
+            lval_del(q);
+            q = x;
+            break;
+        }
+        lval_add(q, x);
+    }
+
+    lseq_iter_del(it);
+    lseq_del(s);
+    return q;
+}
+
+//element i of a list being consumed, moved out when the list is private
+lval* lval_elem(lval* q, int i) {
+
+    if(q->refs) {
+        return lval_copy(q->cell[i]);
+    }
+
+    lval* x = q->cell[i];
+    q->cell[i] = NULL;
+    return x;
+}
+
+//deletes a list some elements of which were moved out by lval_elem
+void lval_del_drained(lval* q) {
+
+    if(!q->refs) {
+        for(int i = 0; i < q->count; i++) {
+            if(q->cell[i]) {
+                lval_del(q->cell[i]);
+            }
+        }
+        q->count = 0;
+    }
+
+    lval_del(q);
+}
+
+//maps f over a Q-Expression, or keeps the elements f is true for
+lval* builtin_each(lenv* e, largs* a, char* name, int keep) {
+
+    ERR_CHECK((a->cell[0]->type == LVAL_FUN), "Function %s passed incorrect type", name);
+
+    lval* f = a->cell[0];
+    lval* q = largs_take(a, 1);
+    lval* r = lval_qexpr();
+    lval_reserve(r, q->count);
+
+    for(int i = 0; i < q->count; i++) {
+
+        lval* x = lval_elem(q, i);
+        lval* y;
+
+        if(keep) {
+            //x is both the argument and the result, share it
+            x = lval_freeze(x);
+            lval* arg = lval_copy(x);
+            y = lval_apply(e, f, 1, &arg);
+        } else {
+            y = lval_apply(e, f, 1, &x);
+            x = NULL;
+        }
+
+        if(y->type == LVAL_ERR) {
+            if(x) {
+                lval_del(x);
+            }
+            lval_del(r);
+            lval_del_drained(q);
+            return y;
+        }
+
+        if(!keep) {
+            lval_add(r, y);
+            continue;
+        }
+
+        if(lval_truthy(y)) {
+            lval_add(r, x);
+        } else {
+            lval_del(x);
+        }
+        lval_del(y);
+    }
+
+    lval_del_drained(q);
+    return r;
+}
+
+//(foldl f init list) is f(f(init, x0), x1)..., foldr is f(x0, f(x1, ... init))
+lval* builtin_fold(lenv* e, largs* a, char* name, int right) {
+
+    ERR_CHECK((a->count == 3), "Function %s passed '%d' arguments, expecting '%d'", name, a->count, 3);
+    ERR_CHECK((a->cell[0]->type == LVAL_FUN), "Function %s passed incorrect type", name);
+
+    //sequences only run forwards
+    if(!right && a->cell[2]->type == LVAL_SEQ) {
+        return builtin_reduce(e, a);
+    }
+
+    ERR_CHECK((a->cell[2]->type == LVAL_QEXPR), "Function %s passed incorrect type", name);
+
+    lval* f = a->cell[0];
+    lval* acc = largs_take(a, 1);
+    lval* q = largs_take(a, 2);
+
+    for(int n = 0; n < q->count && acc->type != LVAL_ERR; n++) {
+
+        lval* x = lval_elem(q, right ? q->count - 1 - n : n);
+        lval* pair[2] = {acc, x};
+
+        if(right) {
+            pair[0] = x;
+            pair[1] = acc;
+        }
+
+        acc = lval_apply(e, f, 2, pair);
+    }
+
+    lval_del_drained(q);
+    return acc;
+}
+
+lval* builtin_foldl(lenv* e, largs* a) {
+    return builtin_fold(e, a, "foldl", 0);
+}
+
+lval* builtin_foldr(lenv* e, largs* a) {
+    return builtin_fold(e, a, "foldr", 1);
+}
+
+lval* builtin_len(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 1), "Function len passed '%d' arguments, expecting '%d'", a->count, 1);
+
+    lval* v = a->cell[0];
+
+    switch(v->type) {
+        case LVAL_QEXPR:
+            return lval_num(v->count);
+        case LVAL_STR:
+            return lval_num(v->len);
+        case LVAL_VEC:
+            return lval_num(v->vec->count);
+        case LVAL_BYTES:
+            return lval_num(v->blen);
+        case LVAL_MAP:
+            return lval_num(lval_map_size(v));
+    }
+
+    return lval_err("Function len passed incorrect type");
+}
+
+lval* builtin_nth(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 2), "Function nth passed '%d' arguments, expecting '%d'", a->count, 2);
+    ERR_CHECK((a->cell[0]->type == LVAL_NUM && a->cell[1]->type == LVAL_QEXPR), "Function nth passed incorrect type");
+
+    long n = a->cell[0]->number;
+    ERR_CHECK((n >= 0 && n < a->cell[1]->count), "Function nth passed index %ld out of range", n);
+
+    lval* q = largs_take(a, 1);
+    lval* x = lval_elem(q, n);
+    lval_del_drained(q);
+    return x;
+}
+
+lval* builtin_reverse(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 1), "Function reverse passed '%d' arguments, expecting '%d'", a->count, 1);
+    ERR_CHECK((a->cell[0]->type == LVAL_QEXPR), "Function reverse passed incorrect type");
+
+    lval* v = lval_unshare(largs_take(a, 0));
+
+    for(int i = 0, j = v->count - 1; i < j; i++, j--) {
+        lval* t = v->cell[i];
+        v->cell[i] = v->cell[j];
+        v->cell[j] = t;
+    }
+
+    return v;
 }
 
-lval* lval_add(lval* v, lval* x) {
-    v->count++;
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-    v->cell[v->count - 1] = x;
-    return v;
-}
+//natural order: numbers by value, strings bytewise and Q-Expressions
+//lexicographically. Sets *bad when x and y cannot be ordered
+int lval_order(lval* x, lval* y, int* bad) {
+
+    if(LVAL_IS_NUMBER(x->type) && LVAL_IS_NUMBER(y->type)) {
+
+        if(x->type == LVAL_NUM && y->type == LVAL_NUM) {
+            return (x->number > y->number) - (x->number < y->number);
+        }
+
+        if(x->type == LVAL_DBL || y->type == LVAL_DBL) {
+            double dx = LVAL_AS_DBL(x);
+            double dy = LVAL_AS_DBL(y);
+            return (dx > dy) - (dx < dy);
+        }
+
+        //bignums always lie outside the range of a long
+        if(x->type != LVAL_BIG) {
+            return y->big->neg ? 1 : -1;
+        }
+        if(y->type != LVAL_BIG) {
+            return x->big->neg ? -1 : 1;
+        }
+        if(x->big->neg != y->big->neg) {
+            return x->big->neg ? -1 : 1;
+        }
+
+        int c = lbig_cmp_mag(x->big->limb, x->big->count, y->big->limb, y->big->count);
+        return x->big->neg ? -c : c;
+    }
+
+    if(x->type == LVAL_STR && y->type == LVAL_STR) {
+
+        char* sx = lval_str_data(x);
+        char* sy = lval_str_data(y);
+        int c = memcmp(sx, sy, x->len < y->len ? x->len : y->len);
+
+        if(c) {
+            return c < 0 ? -1 : 1;
+        }
+        return (x->len > y->len) - (x->len < y->len);
+    }
+
+    if(x->type == LVAL_QEXPR && y->type == LVAL_QEXPR) {
 
-lval* lval_read_num(mpc_ast_t* t) {
-    errno = 0;
-    long x = strtol(t->contents, NULL, 10);
-    return errno != ERANGE ? lval_num(x) : lval_err("Invalid Number");
+        for(int i = 0; i < x->count && i < y->count; i++) {
+            int c = lval_order(x->cell[i], y->cell[i], bad);
+            if(c || *bad) {
+                return c;
+            }
+        }
+        return (x->count > y->count) - (x->count < y->count);
+    }
+
+    *bad = 1;
+    return 0;
 }
 
-lval* lval_read(mpc_ast_t* t) {
-    if(strstr(t->tag, "number")) {
-        return lval_read_num(t);
+//orders x and y through the comparator, or naturally without one
+int lsort_order(lsort* s, lval* x, lval* y) {
+
+    if(s->err) {
+        return 0;
     }
-    if(strstr(t->tag, "symbol")) {
-        return lval_sym(t->contents);
+
+    if(!s->f) {
+        int bad = 0;
+        int c = lval_order(x, y, &bad);
+        if(bad) {
+            s->err = lval_err("Function %s passed values that cannot be ordered", s->name);
+        }
+        return c;
     }
 
-    lval* x = NULL;
-    if(strcmp(t->tag, ">") == 0) {
-        x = lval_sexpr();
+    lval* pair[2] = {lval_copy(x), lval_copy(y)};
+    lval* r = lval_apply(s->e, s->f, 2, pair);
+
+    if(r->type == LVAL_ERR) {
+        s->err = r;
+        return 0;
     }
-    if(strstr(t->tag, "sexpr")) {
-        x = lval_sexpr();
+
+    int c = 0;
+
+    if(r->type == LVAL_NUM) {
+        c = (r->number > 0) - (r->number < 0);
+    } else if(r->type == LVAL_DBL) {
+        c = (r->dbl > 0) - (r->dbl < 0);
+    } else if(r->type == LVAL_BIG) {
+        //a difference that overflowed a long, never zero
+        c = r->big->count == 0 ? 0 : r->big->neg ? -1 : 1;
+    } else {
+        s->err = lval_err("Function %s comparator did not return a number", s->name);
     }
-    if(strstr(t->tag, "qexpr")) {
-        x = lval_qexpr();
+
+    lval_del(r);
+    return c;
+}
+
+//radix keys for a run of all integers or all doubles, ordered as unsigned
+//numbers. Returns 0 for anything else
+int lsort_radix_keys(lval** key, int n, uint64_t* k) {
+
+    int type = n ? key[0]->type : LVAL_NUM;
+
+    if(type != LVAL_NUM && type != LVAL_DBL) {
+        return 0;
     }
 
-    for(int i = 0; i < t->children_num; i++) {
-        if(strcmp(t->children[i]->contents, "(") == 0) {
-            continue;
-        }
-        if(strcmp(t->children[i]->contents, ")") == 0) {
-            continue;
-        }
-        if(strcmp(t->children[i]->contents, "{") == 0) {
-            continue;
+    for(int i = 0; i < n; i++) {
+
+        if(key[i]->type != type) {
+            return 0;
         }
-        if(strcmp(t->children[i]->contents, "}") == 0) {
+
+        if(type == LVAL_NUM) {
+            k[i] = (uint64_t)key[i]->number ^ (1ULL << 63);
             continue;
         }
-        if(strcmp(t->children[i]->tag, "regex") == 0) {
-            continue;
+
+        //negative doubles have every bit flipped, positive ones the sign
+        double d = key[i]->dbl == 0 ? 0 : key[i]->dbl;
+        if(d != d) {
+            return 0;
         }
-        x = lval_add(x, lval_read(t->children[i]));
+
+        uint64_t b;
+        memcpy(&b, &d, sizeof(b));
+        k[i] = b >> 63 ? ~b : b | (1ULL << 63);
     }
-    return x;
-}
 
-void lval_print_expr(lval* v, char open, char close) {
+    return 1;
+}
 
-    putchar (open);
+//stable LSD radix sort of idx by k, a byte at a time, skipping the bytes
+//every key shares
+void lsort_radix(uint64_t* k, int* idx, int n) {
 
-    for(int i = 0; i < v->count; i++) {
-        lval_print(v->cell[i]);
+    int (*count)[256] = calloc(8, sizeof(*count));
 
-        if(i != v->count - 1) {
-            putchar(' ');
+    for(int i = 0; i < n; i++) {
+        for(int b = 0; b < 8; b++) {
+            count[b][(k[i] >> (b * 8)) & 0xff]++;
         }
-
     }
-    putchar(close);
 
-}
-
-void lval_println(lval* v) {
-    lval_print(v);
-    putchar('\n');
-}
+    uint64_t* k2 = malloc(sizeof(uint64_t) * (n > 0 ? n : 1));
+    int* idx2 = malloc(sizeof(int) * (n > 0 ? n : 1));
+    uint64_t* ks = k;
+    int* is = idx;
 
-void lval_print(lval* v) {
+    for(int b = 0; b < 8 && n > 0; b++) {
 
-    switch(v->type) {
-        case LVAL_NUM:
-            printf("%ld", v->number);
-            break;
-        case LVAL_ERR:
-            printf("Error: %s", v->err);
-            break;
-        case LVAL_SYM:
-            printf("%s", v->sym);
-            break;
-        case LVAL_FUN:
-            if(v->fun) {
-                printf("<builtin>");
-            } else {
-                printf("(//");
-                putchar(' ');
-                lval_print(v->formals);
-                putchar(' ');
-                lval_print(v->body);
-                putchar(')');
-            }
-            break;
-        case LVAL_SEXPR:
-            lval_print_expr(v, '(', ')');
-            break;
-        case LVAL_QEXPR:
-            lval_print_expr(v, '{', '}');
-            break;
-    }
-}
+        int* c = count[b];
+        if(c[(ks[0] >> (b * 8)) & 0xff] == n) {
+            continue;
+        }
 
-lval* lval_eval_sexpr(lenv* e, lval* v) {
+        int sum = 0;
+        for(int j = 0; j < 256; j++) {
+            int t = c[j];
+            c[j] = sum;
+            sum += t;
+        }
 
-    for(int i = 0; i < v->count; i++) {
-        v->cell[i] = lval_eval(e, v->cell[i]);
-        if(v->cell[i]->type == LVAL_ERR) {
-            return lval_take(v, i);
+        for(int i = 0; i < n; i++) {
+            int j = c[(ks[i] >> (b * 8)) & 0xff]++;
+            k2[j] = ks[i];
+            idx2[j] = is[i];
         }
-    }
 
-    if(v->count == 0) {
-        return v;
+        uint64_t* tk = ks; ks = k2; k2 = tk;
+        int* ti = is; is = idx2; idx2 = ti;
     }
 
-    if(v->count == 1) {
-        return lval_take(v, 0);
+    if(is != idx) {
+        memcpy(idx, is, sizeof(int) * n);
+        k2 = ks;
+        idx2 = is;
     }
 
-    lval* x = lval_pop(v, 0);
+    free(k2);
+    free(idx2);
+    free(count);
+}
 
-    if(x->type != LVAL_FUN) {
-        lval_del(x);
-        lval_del(v);
-        return lval_err("first argument is not a function");
+//stable merge sort of idx by the keys it indexes, tmp holds n ints
+void lsort_merge(lsort* s, int* idx, int* tmp, int n) {
+
+    //short runs are insertion sorted
+    if(n <= 16) {
+        for(int i = 1; i < n; i++) {
+            int x = idx[i];
+            int j = i;
+            while(j > 0 && lsort_order(s, s->key[idx[j - 1]], s->key[x]) > 0) {
+                idx[j] = idx[j - 1];
+                j--;
+            }
+            idx[j] = x;
+        }
+        return;
     }
 
-    lval* result = x->fun(e, v);
-    lval_del(x);
-    return result;
+    int h = n / 2;
+    lsort_merge(s, idx, tmp, h);
+    lsort_merge(s, idx + h, tmp, n - h);
 
-}
+    //already in order, as for sorted or concatenated sorted input
+    if(lsort_order(s, s->key[idx[h - 1]], s->key[idx[h]]) <= 0) {
+        return;
+    }
 
-lval* lval_eval(lenv* e, lval* v) {
+    memcpy(tmp, idx, sizeof(int) * h);
 
-    if(v->type == LVAL_SYM) {
-        lval* x = lenv_get(e, v);
-        lval_del(v);
-        return x;
+    int i = 0, j = h, o = 0;
+    while(i < h && j < n) {
+        if(lsort_order(s, s->key[idx[j]], s->key[tmp[i]]) < 0) {
+            idx[o++] = idx[j++];
+        } else {
+            idx[o++] = tmp[i++];
+        }
     }
-    if(v->type == LVAL_SEXPR) {
-        return lval_eval_sexpr(e, v);
+    while(i < h) {
+        idx[o++] = tmp[i++];
     }
-    return v;
 }
 
-lval* lval_pop(lval* v, int i) {
-    lval* x = v->cell[i];
+//lambdas of a single argument are key functions, others are comparators
+int lval_is_key_fn(lval* f) {
+    return !f->fun && f->formals->count == 1;
+}
 
-    memmove(&v->cell[i], &v->cell[i + 1], sizeof(lval*) * (v->count - i - 1));
+//(sort list), (sort key list) or (sort cmp list), where cmp returns a
+//negative number, zero or a positive one like -
+lval* builtin_sort(lenv* e, largs* a) {
 
-    v->count--;
+    ERR_CHECK((a->count == 1 || a->count == 2), "Function sort passed '%d' arguments, expecting '%d' or '%d'", a->count, 1, 2);
+    ERR_CHECK((a->cell[a->count - 1]->type == LVAL_QEXPR), "Function sort passed incorrect type");
+    ERR_CHECK((a->count == 1 || a->cell[0]->type == LVAL_FUN), "Function sort passed incorrect type");
 
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-    return x;
+    lval* f = a->count == 2 ? a->cell[0] : NULL;
+    int keyed = f && lval_is_key_fn(f);
 
-}
+    lval* q = largs_take(a, a->count - 1);
+    int n = q->count;
 
-lval* lval_take(lval* v, int i) {
-    lval* x = lval_pop(v, i);
-    lval_del(v);
-    return x;
-}
+    //elements are frozen so handing them to f is cheap
+    lval** val = malloc(sizeof(lval*) * (n > 0 ? n : 1));
+    for(int i = 0; i < n; i++) {
+        val[i] = lval_freeze(lval_elem(q, i));
+    }
+    lval_del_drained(q);
 
-lval* builtin_op(lenv* e, lval* v, char* op) {
+    lsort s = {e, keyed ? NULL : f, val, NULL, "sort"};
 
-    for(int i = 0; i < v->count; i++) {
-        if(v->cell[i]->type != LVAL_NUM) {
-            lval_del(v);
-            return lval_err("Cannot operate on non-numbers");
+    //keys are computed once per element
+    if(keyed) {
+        s.key = malloc(sizeof(lval*) * (n > 0 ? n : 1));
+        for(int i = 0; i < n; i++) {
+
+            if(s.err) {
+                s.key[i] = lval_num(0);
+                continue;
+            }
+
+            lval* arg = lval_copy(val[i]);
+            s.key[i] = lval_freeze(lval_apply(e, f, 1, &arg));
+            if(s.key[i]->type == LVAL_ERR) {
+                s.err = lval_copy(s.key[i]);
+            }
         }
     }
 
-    lval* x = lval_pop(v, 0);
+    int* idx = malloc(sizeof(int) * (n > 0 ? n : 1));
+    for(int i = 0; i < n; i++) {
+        idx[i] = i;
+    }
+
+    uint64_t* k = s.f || s.err ? NULL : malloc(sizeof(uint64_t) * (n > 0 ? n : 1));
 
-    if(strcmp(op, "-") == 0 && v->count == 0) {
-        x->number = -x->number;
+    if(k && lsort_radix_keys(s.key, n, k)) {
+        lsort_radix(k, idx, n);
+    } else if(!s.err) {
+        int* tmp = malloc(sizeof(int) * (n / 2 + 1));
+        lsort_merge(&s, idx, tmp, n);
+        free(tmp);
     }
 
-    while(v->count > 0) {
+    free(k);
 
-        lval* y = lval_pop(v, 0);
+    lval* r = s.err ? s.err : lval_qexpr();
 
-        if(strcmp(op, "+") == 0) {
-            x->number += y->number;
+    if(!s.err) {
+        lval_reserve(r, n);
+        for(int i = 0; i < n; i++) {
+            lval_add(r, val[idx[i]]);
         }
-        if(strcmp(op, "-") == 0) {
-            x->number -= y->number;
+    } else {
+        for(int i = 0; i < n; i++) {
+            lval_del(val[i]);
         }
-        if(strcmp(op, "*") == 0) {
-            x->number *= y->number;
+    }
+
+    if(keyed) {
+        for(int i = 0; i < n; i++) {
+            lval_del(s.key[i]);
         }
-        if(strcmp(op, "/") == 0) {
-            if(y->number == 0) {
-                lval_del(y);
-                lval_del(x);
-                lval* x = lval_err("Division with zero");
+        free(s.key);
+    }
+
+    free(idx);
+    free(val);
+    return r;
+}
+
+//index of the first element of a sorted list ordering equal to x, or -1.
+//(bsearch x list), (bsearch key x list) or (bsearch cmp x list)
+lval* builtin_bsearch(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count == 2 || a->count == 3), "Function bsearch passed '%d' arguments, expecting '%d' or '%d'", a->count, 2, 3);
+    ERR_CHECK((a->cell[a->count - 1]->type == LVAL_QEXPR), "Function bsearch passed incorrect type");
+    ERR_CHECK((a->count == 2 || a->cell[0]->type == LVAL_FUN), "Function bsearch passed incorrect type");
+
+    lval* f = a->count == 3 ? a->cell[0] : NULL;
+    int keyed = f && lval_is_key_fn(f);
+    lval* x = lval_freeze(largs_take(a, a->count - 2));
+    lval* q = a->cell[a->count - 1];
+
+    lsort s = {e, keyed ? NULL : f, NULL, NULL, "bsearch"};
+
+    int lo = 0;
+    int hi = q->count;
+    int found = 0;
+
+    //lower bound, then a check that it orders equal
+    while(lo < hi && !s.err) {
+
+        int mid = lo + (hi - lo) / 2;
+        lval* y = q->cell[mid];
+
+        if(keyed) {
+            lval* arg = lval_copy(y);
+            y = lval_apply(e, f, 1, &arg);
+            if(y->type == LVAL_ERR) {
+                s.err = y;
                 break;
             }
-            x->number /= y->number;
         }
-        lval_del(y);
+
+        int c = lsort_order(&s, y, x);
+
+        if(keyed) {
+            lval_del(y);
+        }
+
+        if(c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+            found = c == 0;
+        }
     }
 
-    lval_del(v);
+    lval_del(x);
 
-    return x;
+    if(s.err) {
+        return s.err;
+    }
+
+    return lval_num(found ? lo : -1);
 }
 
-lval* builtin_head(lenv* e, lval* a) {
+lval* builtin_head(lenv* e, largs* a) {
 
-    ERR_CHECK(a, (a->count == 1), "Function head passed  '%d' arguments, expecting '%d'", a->count, 1);
-    ERR_CHECK(a, (a->cell[0]->type == LVAL_QEXPR), "Function head passed correct type of argument");
-    ERR_CHECK(a, (a->count != 0), "Function head passed {}");
+    ERR_CHECK((a->count == 1), "Function head passed  '%d' arguments, expecting '%d'", a->count, 1);
+    ERR_CHECK((a->cell[0]->type == LVAL_QEXPR), "Function head passed correct type of argument");
+    ERR_CHECK((a->cell[0]->count != 0), "Function head passed {}");
 
-    lval* v = lval_take(a, 0);
+    lval* v = lval_unshare(largs_take(a, 0));
 
     while(v->count > 1) {
-        lval_del(lval_pop(v, 1));
+        lval_del(lval_pop(v, v->count - 1));
     }
 
     return v;
 }
 
-lval* builtin_tail(lenv* e, lval* a) {
+lval* builtin_tail(lenv* e, largs* a) {
 
-    ERR_CHECK(a, (a->count == 1), "Function tail passed '%d' arguments, expecting '%d'", a->count, 1);
-    ERR_CHECK(a, (a->cell[0]->type == LVAL_QEXPR), "Function tail not passed correct type of argument");
-    ERR_CHECK(a, (a->count != 0), "Function tail passed {}");
+    ERR_CHECK((a->count == 1), "Function tail passed '%d' arguments, expecting '%d'", a->count, 1);
+    ERR_CHECK((a->cell[0]->type == LVAL_QEXPR), "Function tail not passed correct type of argument");
+    ERR_CHECK((a->cell[0]->count != 0), "Function tail passed {}");
 
 
-    lval*v = lval_take(a, 0);
+    lval*v = lval_unshare(largs_take(a, 0));
 
     lval_del(lval_pop(v, 0));
 
@@ -644,18 +5835,24 @@ lval* builtin_tail(lenv* e, lval* a) {
 
 }
 
-lval* builtin_list(lenv* e, lval* a) {
-    a->type = LVAL_QEXPR;
+lval* builtin_list(lenv* e, largs* a) {
+
+    lval* x = lval_qexpr();
+    lval_reserve(x, a->count);
+
+    for(int i = 0; i < a->count; i++) {
+        lval_add(x, largs_take(a, i));
+    }
 
-    return a;
+    return x;
 
 }
 
-lval* builtin_eval(lenv* e, lval* a) {
-    ERR_CHECK(a, (a->count == 1), "Function eval passed '%d' arguments, expecting '%d'", a->count, 1);
-    ERR_CHECK(a, (a->cell[0]->type == LVAL_QEXPR), "Function eval passed invaild arguments");
+lval* builtin_eval(lenv* e, largs* a) {
+    ERR_CHECK((a->count == 1), "Function eval passed '%d' arguments, expecting '%d'", a->count, 1);
+    ERR_CHECK((a->cell[0]->type == LVAL_QEXPR), "Function eval passed invaild arguments");
 
-    lval* x = lval_take(a, 0);
+    lval* x = lval_unshare(largs_take(a, 0));
 
     x->type = LVAL_SEXPR;
 
@@ -663,97 +5860,240 @@ lval* builtin_eval(lenv* e, lval* a) {
 
 }
 
-lval* builtin_join(lenv* e, lval* a) {
+lval* builtin_join(lenv* e, largs* a) {
+
+    ERR_CHECK((a->count > 0), "Function join passed no arguments");
+
+    //joining strings concatenates them
+    int type = a->cell[0]->type == LVAL_STR ? LVAL_STR : LVAL_QEXPR;
 
     for(int i = 0; i < a->count; i++) {
-        ERR_CHECK(a, (a->cell[i]->type == LVAL_QEXPR), "Function join passed incorrect types");
+        ERR_CHECK((a->cell[i]->type == type), "Function join passed incorrect types");
     }
 
-    lval* x = lval_pop(a, 0);
+    if(type == LVAL_STR) {
+        lval* x = largs_take(a, 0);
+        for(int i = 1; i < a->count; i++) {
+            x = lval_str_cat(x, largs_take(a, i));
+        }
+        return x;
+    }
+
+    int total = 0;
+    for(int i = 0; i < a->count; i++) {
+        total += a->cell[i]->count;
+    }
 
-    while(a->count) {
+    lval* x = lval_unshare(largs_take(a, 0));
+    lval_reserve(x, total);
 
-        x = lval_join(x, lval_pop(a, 0));
+    for(int i = 1; i < a->count; i++) {
+
+        x = lval_join(x, largs_take(a, i));
 
     }
 
-    lval_del(a);
     return x;
 
 }
 
 lval* lval_join(lval* x, lval* y) {
 
-    while(y->count) {
-        lval_add(x, lval_pop(y, 0));
-    }
+    x = lval_unshare(x);
+    y = lval_unshare(y);
+
+    lval_reserve(x, x->count + y->count);
+    memcpy(&x->cell[x->count], y->cell, sizeof(lval*) * y->count);
+    x->count += y->count;
+    y->count = 0;
 
     lval_del(y);
     return x;
 
 }
 
-lval* lval_lambda(lval* formals, lval* body) {
+lval* lval_lambda(lenv* env, lval* formals, lval* body) {
 
     lval* v =  malloc(sizeof(lval));
     v->type = LVAL_FUN;
 
     v->fun = NULL;
+    v->refs = 0;
+
+    //adopts env, formals and body are frozen so copies of v share them
+    v->env = env;
+
+    v->formals = lval_freeze(formals);
+    v->body = lval_freeze_all(body);
+
+    return v;
+}
 
-    v->env = lenv_new();
+lval* lval_freeze(lval* v) {
 
-    v->formals = formals;
-    v->body = body;
+    if(!v->refs) {
+        v->refs = 1;
+        v->interned = 0;
+    }
 
     return v;
 }
 
-lval* builtin_lambda(lenv* e, lval* a) {
-    /* Check Two arguments, each of which are Q-Expressions 
-       LASSERT_NUM("\\", a, 2);
-       LASSERT_TYPE("\\", a, 0, LVAL_QEXPR);
-       LASSERT_TYPE("\\", a, 1, LVAL_QEXPR);
+//freezes v and every private expression inside it, so a copy of a lambda
+//body for a call only duplicates the S-Expressions evaluation rewrites
+lval* lval_freeze_all(lval* v) {
+
+    if(v->refs) {
+        return v;
+    }
+
+    if(v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) {
+        for(int i = 0; i < v->count; i++) {
+            v->cell[i] = lval_freeze_all(v->cell[i]);
+        }
+    }
+
+    return lval_freeze(v);
+}
+
+lval* lval_call(lenv* e, lval* f, largs* a) {
+
+    if(f->fun) {
+        return f->fun(e, a);
+    }
+
+    lval* formals = f->formals;
+
+    //arguments are bound in a fresh frame on top of the shared closure one
+    lenv* frame = lenv_new();
+    frame->par = lenv_share(f->env);
+
+    int given = 0;
+    int i = 0;
+
+    while(i < formals->count) {
+
+        if(strcmp(formals->cell[i]->sym, "&") == 0) {
+
+            if(i != formals->count - 2) {
+                lenv_del(frame);
+                return lval_err("Function format invalid. Symbol '&' not followed by single symbol.");
+            }
+
+            lval* rest = lval_qexpr();
+            lval_reserve(rest, a->count - given);
+            while(given < a->count) {
+                lval_add(rest, largs_take(a, given++));
+            }
+
+            lenv_put_move(frame, lval_copy(formals->cell[i + 1]), rest);
+            i += 2;
+            break;
+        }
+
+        if(given == a->count) {
+            break;
+        }
+
+        lenv_put_move(frame, lval_copy(formals->cell[i]), largs_take(a, given++));
+        i++;
+    }
+
+    if(given < a->count) {
+        lenv_del(frame);
+        return lval_err("Function passed too many arguments. Got %i, Expected %i.", a->count, formals->count);
+    }
+
+    //partially applied, the bound frame becomes the new closure environment
+    if(i < formals->count) {
+
+        lval* rest = lval_qexpr();
+        lval_reserve(rest, formals->count - i);
+        for(; i < formals->count; i++) {
+            lval_add(rest, lval_copy(formals->cell[i]));
+        }
+
+        return lval_lambda(frame, rest, lval_copy(f->body));
+    }
+
+    lval* body = lval_unshare(lval_copy(f->body));
+    body->type = LVAL_SEXPR;
+
+    lval* result = lval_eval(frame, body);
+    lenv_del(frame);
+
+    return result;
+}
+
+lval* builtin_lambda(lenv* e, largs* a) {
 
-       Check first Q-Expression contains only Symbols
-       for (int i = 0; i < a->cell[0]->count; i++) {
-       ERR_CHECK(a, (a->cell[0]->cell[i]->type == LVAL_SYM),
-       "Cannot define non-symbol. Got %s, Expected %s.",
-       ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
-       }
-       */
+    ERR_CHECK((a->count == 2), "Function \\ passed '%d' arguments, expecting '%d'", a->count, 2);
+    ERR_CHECK((a->cell[0]->type == LVAL_QEXPR && a->cell[1]->type == LVAL_QEXPR), "Function \\ passed incorrect type");
 
-    /* Pop first two arguments and pass them to lval_lambda */
-    lval* formals = lval_pop(a, 0);
-    lval* body = lval_pop(a, 0);
-    lval_del(a);
+    for(int i = 0; i < a->cell[0]->count; i++) {
+        ERR_CHECK((a->cell[0]->cell[i]->type == LVAL_SYM), "Cannot define non-symbol");
+    }
+
+    /* Take first two arguments and pass them to lval_lambda */
+    lval* formals = largs_take(a, 0);
+    lval* body = largs_take(a, 1);
 
-    return lval_lambda(formals, body);
+    return lval_lambda(lenv_share(e), formals, body);
 }
 
-lval* builtin_var(lenv* e, lval* a, char* func) {
+lval* builtin_var(lenv* e, largs* a, char* func) {
+
+    ERR_CHECK((a->count > 0 && a->cell[0]->type == LVAL_QEXPR), "Function %s passed incorrect type", func);
 
     lval* syms = a->cell[0];
 
+    ERR_CHECK((syms->count == a->count - 1), "Function %s cannot define incorrect number of values to symbols", func);
+
     for(int i = 0; i < syms->count; i++) {
+        ERR_CHECK((syms->cell[i]->type == LVAL_SYM), "Function %s cannot define non-symbol", func);
+    }
+
+    syms = lval_unshare(largs_take(a, 0));
+
+    for(int i = 1; i < a->count; i++) {
         if(strcmp("def", func) == 0) {
-            lenv_def(e, syms->cell[i], a->cell[i + 1]);
+            lenv_def_move(e, lval_pop(syms, 0), largs_take(a, i));
         }
         if(strcmp("=", func) == 0) {
-            lenv_put(e, syms->cell[i], a->cell[i + 1]);
+            lenv_put_move(e, lval_pop(syms, 0), largs_take(a, i));
         } 
     }
 
-    lval_del(a);
+    lval_del(syms);
     return lval_sexpr();
 
 }
 
-lval* builtin_def(lenv* e, lval* a) {
+lval* builtin_def(lenv* e, largs* a) {
     return builtin_var(e, a, "def");
 }
 
-lval* builtin_put(lenv* e, lval* a) {
+lval* builtin_put(lenv* e, largs* a) {
     return builtin_var(e, a, "=");
 }
 
+lval* builtin_cmp(lenv* e, largs* a, char* op) {
+
+    ERR_CHECK((a->count == 2), "Function %s passed '%d' arguments, expecting '%d'", op, a->count, 2);
+
+    int r = lval_eq(a->cell[0], a->cell[1]);
+
+    if(strcmp(op, "!=") == 0) {
+        r = !r;
+    }
+
+    return lval_num(r);
+}
+
+lval* builtin_eq(lenv* e, largs* a) {
+    return builtin_cmp(e, a, "==");
+}
 
+lval* builtin_ne(lenv* e, largs* a) {
+    return builtin_cmp(e, a, "!=");
+}
@@ -1,5 +1,29 @@
+/* Regular files are mapped into memory where the platform allows it */
+#if defined(__unix__) || defined(__APPLE__)
+#if !defined(_POSIX_C_SOURCE) && !defined(_GNU_SOURCE) && !defined(__APPLE__)
+#define _POSIX_C_SOURCE 200112L
+#endif
+#define MPC_MMAP 1
+#endif
+
 #include "mpc.h"
 
+#ifdef MPC_MMAP
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* Per-thread parse state, where the compiler allows it */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+#define MPC_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define MPC_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define MPC_THREAD_LOCAL __declspec(thread)
+#endif
+
 /*
  ** State Type
  */
@@ -30,6 +54,15 @@ static mpc_state_t *mpc_state_copy(mpc_state_t s) {
  ** Error Type
  */
 
+/*
+** Most failures are thrown away when a later
+** alternative matches, so until a parse fails
+** outright they are all represented by this one
+** marker, which the functions below pass along
+** without allocating. See `mpc_parse_input`.
+*/
+static mpc_err_t mpc_err_marker;
+
 static mpc_err_t *mpc_err_new(const char *filename, mpc_state_t s, const char *expected, char recieved) {
     mpc_err_t *x = malloc(sizeof(mpc_err_t));
     x->filename = malloc(strlen(filename) + 1);
@@ -60,6 +93,9 @@ static mpc_err_t *mpc_err_fail(const char *filename, mpc_state_t s, const char *
 void mpc_err_delete(mpc_err_t *x) {
 
     int i;
+
+    if (x == &mpc_err_marker) { return; }
+
     for (i = 0; i < x->expected_num; i++) {
         free(x->expected[i]);
     }
@@ -102,6 +138,32 @@ static void mpc_err_clear_expected(mpc_err_t *x, char *expected) {
 
 }
 
+static mpc_err_t *mpc_err_copy(mpc_err_t *x) {
+
+    int i;
+    mpc_err_t *y;
+
+    if (x == &mpc_err_marker) { return x; }
+
+    y = malloc(sizeof(mpc_err_t));
+    y->filename = malloc(strlen(x->filename) + 1);
+    strcpy(y->filename, x->filename);
+    y->state = x->state;
+    y->expected_num = x->expected_num;
+    y->expected = x->expected_num ? malloc(sizeof(char*) * x->expected_num) : NULL;
+    for (i = 0; i < x->expected_num; i++) {
+        y->expected[i] = malloc(strlen(x->expected[i]) + 1);
+        strcpy(y->expected[i], x->expected[i]);
+    }
+    y->failure = NULL;
+    if (x->failure) {
+        y->failure = malloc(strlen(x->failure) + 1);
+        strcpy(y->failure, x->failure);
+    }
+    y->recieved = x->recieved;
+    return y;
+}
+
 void mpc_err_print(mpc_err_t *x) {
     mpc_err_print_to(x, stdout);
 }
@@ -188,7 +250,15 @@ char *mpc_err_string(mpc_err_t *x) {
 static mpc_err_t *mpc_err_or(mpc_err_t** x, int n) {
 
     int i, j;
-    mpc_err_t *e = malloc(sizeof(mpc_err_t));
+    mpc_err_t *e;
+
+    for (i = 0; i < n; i++) {
+        if (x[i] != &mpc_err_marker) { continue; }
+        for (j = 0; j < n; j++) { mpc_err_delete(x[j]); }
+        return &mpc_err_marker;
+    }
+
+    e = malloc(sizeof(mpc_err_t));
     e->state = mpc_state_invalid();
     e->expected_num = 0;
     e->expected = NULL;
@@ -227,7 +297,11 @@ static mpc_err_t *mpc_err_or(mpc_err_t** x, int n) {
 static mpc_err_t *mpc_err_repeat(mpc_err_t *x, const char *prefix) {
 
     int i;
-    char *expect = malloc(strlen(prefix) + 1);
+    char *expect;
+
+    if (x == &mpc_err_marker) { return x; }
+
+    expect = malloc(strlen(prefix) + 1);
     strcpy(expect, prefix);
 
     if (x->expected_num == 1) {
@@ -291,15 +365,16 @@ static mpc_err_t *mpc_err_count(mpc_err_t *x, int n) {
  ** by seeking in the file at different positions.
  **
  ** The final mode is Pipe. This is the difficult
- ** one. As we assume pipes cannot be seeked - and 
- ** only support a single character lookahead at 
- ** any point, when the input is marked for a 
- ** potential backtracking we start buffering any 
- ** input.
+ ** one. As we assume pipes cannot be seeked, the
+ ** input is read in blocks into a buffer which
+ ** keeps everything from the oldest live mark
+ ** onwards, and older bytes are dropped when the
+ ** next block comes in.
  **
  ** This means that if we are requested to seek
  ** back we can simply start reading from the
- ** buffer instead of the input.
+ ** buffer instead of the input, and memory only
+ ** grows with the longest backtrack.
  **
  ** Of course using `mpc_predictive` will disable
  ** backtracking and make LL(1) grammars easy
@@ -319,19 +394,82 @@ typedef struct {
     char *filename;  
     mpc_state_t state;
 
-    char *string;
+    const char *string;
+    int length;
     char *buffer;
+    int buffer_pos;
+    int buffer_len;
+    int buffer_max;
+    int buffer_end;
+    int buffer_taken;
     FILE *file;
+    int mapped;
 
     int backtrack;
     int marks_num;
+    int marks_slots;
     mpc_state_t* marks;
     char* lasts;
 
     char last;
 
+    /* Whether failures leave only a marker and the DFA and memo shortcuts are taken */
+    int fast;
+
 } mpc_input_t;
 
+/*
+** Marks are pushed for every `or` and `many`
+** attempt, so their arrays only ever grow and
+** are passed on to the next input on the same
+** thread when this one is deleted.
+*/
+
+#define MPC_INPUT_MARKS_MIN 32
+#define MPC_CACHE_MAX 4096
+
+#ifdef MPC_THREAD_LOCAL
+static MPC_THREAD_LOCAL int mpc_input_cache_slots = 0;
+static MPC_THREAD_LOCAL mpc_state_t *mpc_input_cache_marks = NULL;
+static MPC_THREAD_LOCAL char *mpc_input_cache_lasts = NULL;
+#endif
+
+static void mpc_input_marks_reserve(mpc_input_t *i) {
+
+#ifdef MPC_THREAD_LOCAL
+    if (i->marks_slots == 0 && mpc_input_cache_slots) {
+        i->marks_slots = mpc_input_cache_slots;
+        i->marks = mpc_input_cache_marks;
+        i->lasts = mpc_input_cache_lasts;
+        mpc_input_cache_slots = 0;
+        mpc_input_cache_marks = NULL;
+        mpc_input_cache_lasts = NULL;
+        return;
+    }
+#endif
+
+    i->marks_slots = i->marks_slots ? i->marks_slots * 2 : MPC_INPUT_MARKS_MIN;
+    i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_slots);
+    i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);
+}
+
+static void mpc_input_marks_release(mpc_input_t *i) {
+
+#ifdef MPC_THREAD_LOCAL
+    if (i->marks_slots <= MPC_CACHE_MAX && i->marks_slots > mpc_input_cache_slots) {
+        free(mpc_input_cache_marks);
+        free(mpc_input_cache_lasts);
+        mpc_input_cache_slots = i->marks_slots;
+        mpc_input_cache_marks = i->marks;
+        mpc_input_cache_lasts = i->lasts;
+        return;
+    }
+#endif
+
+    free(i->marks);
+    free(i->lasts);
+}
+
 static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
 
     mpc_input_t *i = malloc(sizeof(mpc_input_t));
@@ -342,18 +480,28 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
 
     i->state = mpc_state_new();
 
-    i->string = malloc(strlen(string) + 1);
-    strcpy(i->string, string);
+    /* The caller's string outlives the parse so it is read in place */
+    i->string = string;
+    i->length = strlen(string);
     i->buffer = NULL;
+    i->buffer_pos = 0;
+    i->buffer_len = 0;
+    i->buffer_max = 0;
+    i->buffer_end = 0;
+    i->buffer_taken = 0;
     i->file = NULL;
+    i->mapped = 0;
 
     i->backtrack = 1;
     i->marks_num = 0;
+    i->marks_slots = 0;
     i->marks = NULL;
     i->lasts = NULL;
 
     i->last = '\0';
 
+    i->fast = 1;
+
     return i;
 }
 
@@ -368,16 +516,27 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
     i->state = mpc_state_new();
 
     i->string = NULL;
+    i->length = 0;
     i->buffer = NULL;
+    i->buffer_pos = 0;
+    i->buffer_len = 0;
+    i->buffer_max = 0;
+    i->buffer_end = 0;
+    i->buffer_taken = 0;
     i->file = pipe;
+    i->mapped = 0;
 
     i->backtrack = 1;
     i->marks_num = 0;
+    i->marks_slots = 0;
     i->marks = NULL;
     i->lasts = NULL;
 
     i->last = '\0';
 
+    /* A pipe cannot be parsed again, so its errors are kept exact from the start */
+    i->fast = 0;
+
     return i;
 
 }
@@ -392,16 +551,55 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
     i->state = mpc_state_new();
 
     i->string = NULL;
+    i->length = 0;
     i->buffer = NULL;
+    i->buffer_pos = 0;
+    i->buffer_len = 0;
+    i->buffer_max = 0;
+    i->buffer_end = 0;
+    i->buffer_taken = 0;
     i->file = file;
+    i->mapped = 0;
 
     i->backtrack = 1;
     i->marks_num = 0;
+    i->marks_slots = 0;
     i->marks = NULL;
     i->lasts = NULL;
 
     i->last = '\0';
 
+    i->fast = 1;
+
+#ifdef MPC_MMAP
+    /*
+    ** A mapped regular file is read like a string input, so peeking and
+    ** backtracking are pointer moves rather than stdio calls. String
+    ** inputs end in a zero byte, which the mapping only has when the
+    ** file stops short of a page boundary, since the rest of that page
+    ** reads as zeros. Anything else, including a file that has already
+    ** been read from, keeps reading through the FILE.
+    */
+    {
+        struct stat st;
+        void *data;
+
+        if (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode) &&
+                st.st_size > 0 && st.st_size < INT_MAX &&
+                st.st_size % sysconf(_SC_PAGESIZE) != 0 && ftell(file) == 0) {
+
+            data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+
+            if (data != MAP_FAILED) {
+                i->type = MPC_INPUT_STRING;
+                i->string = data;
+                i->length = st.st_size;
+                i->mapped = 1;
+            }
+        }
+    }
+#endif
+
     return i;
 }
 
@@ -409,14 +607,33 @@ static void mpc_input_delete(mpc_input_t *i) {
 
     free(i->filename);
 
-    if (i->type == MPC_INPUT_STRING) { free(i->string); }
-    if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
+    /* Like a peek, a last byte read but never consumed goes back to the stream */
+    if (i->type == MPC_INPUT_PIPE) {
+        if (i->buffer_taken < i->buffer_pos + i->buffer_len) {
+            ungetc((unsigned char)i->buffer[i->buffer_len - 1], i->file);
+        }
+        free(i->buffer);
+    }
 
-    free(i->marks);
-    free(i->lasts);
+#ifdef MPC_MMAP
+    if (i->mapped) { munmap((void*)i->string, i->length); }
+#endif
+
+    mpc_input_marks_release(i);
     free(i);
 }
 
+static void mpc_input_jump(mpc_input_t *i, mpc_state_t s, char last) {
+
+    i->state = s;
+    i->last = last;
+
+    if (i->type == MPC_INPUT_FILE) {
+        fseek(i->file, i->state.pos, SEEK_SET);
+    }
+
+}
+
 static void mpc_input_backtrack_disable(mpc_input_t *i) { i->backtrack--; }
 static void mpc_input_backtrack_enable(mpc_input_t *i) { i->backtrack++; }
 
@@ -424,16 +641,12 @@ static void mpc_input_mark(mpc_input_t *i) {
 
     if (i->backtrack < 1) { return; }
 
+    if (i->marks_num == i->marks_slots) { mpc_input_marks_reserve(i); }
+
     i->marks_num++;
-    i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_num);
-    i->lasts = realloc(i->lasts, sizeof(char) * i->marks_num);
     i->marks[i->marks_num-1] = i->state;
     i->lasts[i->marks_num-1] = i->last;
 
-    if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-        i->buffer = calloc(1, 1);
-    }
-
 }
 
 static void mpc_input_unmark(mpc_input_t *i) {
@@ -441,13 +654,6 @@ static void mpc_input_unmark(mpc_input_t *i) {
     if (i->backtrack < 1) { return; }
 
     i->marks_num--;
-    i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_num);
-    i->lasts = realloc(i->lasts, sizeof(char) * i->marks_num);
-
-    if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-        free(i->buffer);
-        i->buffer = NULL;
-    }
 
 }
 
@@ -465,18 +671,60 @@ static void mpc_input_rewind(mpc_input_t *i) {
     mpc_input_unmark(i);
 }
 
-static int mpc_input_buffer_in_range(mpc_input_t *i) {
-    return i->state.pos < (strlen(i->buffer) + i->marks[0].pos);
+#define MPC_INPUT_BLOCK 4096
+
+/*
+** Makes sure the pipe byte at the current position is buffered, reading
+** it if it is not. Returns 0 at the end of the input.
+**
+** Bytes are taken from the stream one at a time, stdio already reads
+** the pipe in blocks, so a parse never waits on input past what it
+** looks at and the rest is left for the caller. The buffer only grows
+** or drops the bytes behind the oldest mark when it is full.
+*/
+static int mpc_input_buffer_fill(mpc_input_t *i) {
+
+    int drop, c;
+
+    if (i->state.pos < i->buffer_pos + i->buffer_len) { return 1; }
+    if (i->buffer_end) { return 0; }
+
+    if (i->buffer_len == i->buffer_max) {
+
+        /* Nothing behind the oldest mark can be read again */
+        drop = (i->marks_num > 0 ? i->marks[0].pos : i->state.pos) - i->buffer_pos;
+
+        if (drop > 0) {
+            memmove(i->buffer, i->buffer + drop, i->buffer_len - drop);
+            i->buffer_pos += drop;
+            i->buffer_len -= drop;
+        }
+
+        if (i->buffer_len >= i->buffer_max / 2) {
+            i->buffer_max = i->buffer_max ? i->buffer_max * 2 : MPC_INPUT_BLOCK;
+            i->buffer = realloc(i->buffer, i->buffer_max);
+        }
+    }
+
+    c = getc(i->file);
+
+    if (c == EOF) {
+        i->buffer_end = 1;
+        return 0;
+    }
+
+    i->buffer[i->buffer_len++] = c;
+    return 1;
 }
 
 static char mpc_input_buffer_get(mpc_input_t *i) {
-    return i->buffer[i->state.pos - i->marks[0].pos];
+    return mpc_input_buffer_fill(i) ? i->buffer[i->state.pos - i->buffer_pos] : '\0';
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
-    if (i->type == MPC_INPUT_STRING && i->state.pos == strlen(i->string)) { return 1; }
+    if (i->type == MPC_INPUT_STRING && i->state.pos == i->length) { return 1; }
     if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
-    if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
+    if (i->type == MPC_INPUT_PIPE && !mpc_input_buffer_fill(i)) { return 1; }
     return 0;
 }
 
@@ -488,17 +736,7 @@ static char mpc_input_getc(mpc_input_t *i) {
 
         case MPC_INPUT_STRING: return i->string[i->state.pos];
         case MPC_INPUT_FILE: c = fgetc(i->file); return c;
-        case MPC_INPUT_PIPE:
-
-                             if (!i->buffer) { c = getc(i->file); return c; }
-
-                             if (i->buffer && mpc_input_buffer_in_range(i)) {
-                                 c = mpc_input_buffer_get(i);
-                                 return c;
-                             } else {
-                                 c = getc(i->file);
-                                 return c;
-                             }
+        case MPC_INPUT_PIPE: return mpc_input_buffer_get(i);
 
         default: return c;
     }
@@ -518,44 +756,28 @@ static char mpc_input_peekc(mpc_input_t *i) {
                                fseek(i->file, -1, SEEK_CUR);
                                return c;
 
-        case MPC_INPUT_PIPE:
-
-                               if (!i->buffer) {
-                                   c = getc(i->file);
-                                   if (feof(i->file)) { return '\0'; }
-                                   ungetc(c, i->file);
-                                   return c;
-                               }
-
-                               if (i->buffer && mpc_input_buffer_in_range(i)) {
-                                   return mpc_input_buffer_get(i);
-                               } else {
-                                   c = getc(i->file);
-                                   if (feof(i->file)) { return '\0'; }
-                                   ungetc(c, i->file);
-                                   return c;
-                               }
+        case MPC_INPUT_PIPE: return mpc_input_buffer_get(i);
 
         default: return c;
     }
 
 }
 
+/* The error for failing here, which is just the marker in fast mode */
+static mpc_err_t *mpc_input_err_fail(mpc_input_t *i, const char *failure) {
+    return i->fast ? &mpc_err_marker : mpc_err_fail(i->filename, i->state, failure);
+}
+
+static mpc_err_t *mpc_input_err_new(mpc_input_t *i, const char *expected) {
+    return i->fast ? &mpc_err_marker : mpc_err_new(i->filename, i->state, expected, mpc_input_peekc(i));
+}
+
 static int mpc_input_failure(mpc_input_t *i, char c) {
 
     switch (i->type) {
         case MPC_INPUT_STRING: break;
         case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); break;
-        case MPC_INPUT_PIPE:
-
-                             if (!i->buffer) { ungetc(c, i->file); break; }
-
-                             if (i->buffer && mpc_input_buffer_in_range(i)) {
-                                 break;
-                             } else {
-                                 ungetc(c, i->file); 
-                             }
-
+        case MPC_INPUT_PIPE: break;
     }
 
     return 0;
@@ -563,19 +785,12 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
 
 static int mpc_input_success(mpc_input_t *i, char c, char **o) {
 
-    if (i->type == MPC_INPUT_PIPE &&
-            i->buffer &&
-            !mpc_input_buffer_in_range(i)) {
-
-        i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-        i->buffer[strlen(i->buffer) + 1] = '\0';
-        i->buffer[strlen(i->buffer) + 0] = c;
-    }
-
     i->last = c;
     i->state.pos++;
     i->state.col++;
 
+    if (i->state.pos > i->buffer_taken) { i->buffer_taken = i->state.pos; }
+
     if (c == '\n') {
         i->state.col = 0;
         i->state.row++;
@@ -684,7 +899,9 @@ enum {
     MPC_TYPE_COUNT     = 22,
 
     MPC_TYPE_OR        = 23,
-    MPC_TYPE_AND       = 24
+    MPC_TYPE_AND       = 24,
+
+    MPC_TYPE_DFA       = 25
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -702,6 +919,7 @@ typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
 typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct { struct mpc_dfa_t *d; mpc_parser_t *x; } mpc_pdata_dfa_t;
 
 typedef union {
     mpc_pdata_fail_t fail;
@@ -719,15 +937,635 @@ typedef union {
     mpc_pdata_repeat_t repeat;
     mpc_pdata_and_t and;
     mpc_pdata_or_t or;
+    mpc_pdata_dfa_t dfa;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
     char retained;
+    char memo;
     char *name;
     char type;
     mpc_pdata_t data;
 };
 
+/*
+ ** DFA Type
+ */
+
+/*
+ ** A regex is built as a tree of the normal
+ ** combinators, which match it one character
+ ** per stack step with full backtracking. When
+ ** the tree is simple enough it is also turned
+ ** into a Thompson NFA, from which the DFA is
+ ** built by subset construction when the regex
+ ** is compiled. Matching a token is then a loop
+ ** over the transition table.
+ **
+ ** The combinators give regexes PEG semantics,
+ ** so `*` never gives characters back and `|`
+ ** takes the first alternative that matches,
+ ** whereas the DFA finds the longest match.
+ ** These agree as long as the next character
+ ** always decides which way to go, so only
+ ** regexes passing that LL(1) check are given
+ ** a DFA. Anchors, counts and lookaheads keep
+ ** the combinators, as do regexes needing more
+ ** than MPC_DFA_MAX states.
+ **
+ ** The table is only read while parsing, so a
+ ** regex can be shared between threads.
+ */
+
+#define MPC_DFA_MAX 256
+
+enum {
+    MPC_NFA_SET   = 0,
+    MPC_NFA_SPLIT = 1,
+    MPC_NFA_EMPTY = 2,
+    MPC_NFA_MATCH = 3
+};
+
+typedef struct {
+    int type;
+    int out;
+    int out1;
+    unsigned char set[32];
+} mpc_nfa_t;
+
+typedef struct mpc_dfa_t {
+
+    int nfa_num;
+    mpc_nfa_t *nfa;
+
+    /* State 0 is the dead state and state 1 the start */
+    int states_num;
+    int states_slots;
+    int *trans;
+    char *accept;
+    int *subsets;
+    int *subsets_len;
+
+    int gen;
+    int *seen;
+    int *todo;
+    int *next;
+
+} mpc_dfa_t;
+
+static void mpc_dfa_set_add(unsigned char *set, unsigned char c) {
+    set[c >> 3] |= 1 << (c & 7);
+}
+
+static int mpc_dfa_set_has(const unsigned char *set, unsigned char c) {
+    return set[c >> 3] & (1 << (c & 7));
+}
+
+static int mpc_dfa_set_meets(const unsigned char *x, const unsigned char *y) {
+    int i;
+    for (i = 0; i < 32; i++) { if (x[i] & y[i]) { return 1; } }
+    return 0;
+}
+
+static void mpc_dfa_set_union(unsigned char *x, const unsigned char *y) {
+    int i;
+    for (i = 0; i < 32; i++) { x[i] |= y[i]; }
+}
+
+/*
+** The input bytes a primitive accepts. A zero
+** byte is never in the set, the matcher hands
+** those inputs back to the combinators.
+*/
+static void mpc_dfa_set_of(mpc_parser_t *p, unsigned char *set) {
+
+    int c;
+    for (c = 1; c < 256; c++) {
+        switch (p->type) {
+            case MPC_TYPE_ANY: break;
+            case MPC_TYPE_SINGLE: if ((char)c != p->data.single.x) { continue; } break;
+            case MPC_TYPE_RANGE:
+                if ((char)c < p->data.range.x || (char)c > p->data.range.y) { continue; }
+                break;
+            case MPC_TYPE_ONEOF: if (!strchr(p->data.string.x, c)) { continue; } break;
+            case MPC_TYPE_NONEOF: if (strchr(p->data.string.x, c)) { continue; } break;
+            default: continue;
+        }
+        mpc_dfa_set_add(set, c);
+    }
+
+}
+
+static int mpc_dfa_nullable(mpc_parser_t *p) {
+
+    int i;
+
+    switch (p->type) {
+        case MPC_TYPE_LIFT:
+        case MPC_TYPE_MAYBE:
+        case MPC_TYPE_MANY:  return 1;
+        case MPC_TYPE_EXPECT: return mpc_dfa_nullable(p->data.expect.x);
+        case MPC_TYPE_MANY1: return mpc_dfa_nullable(p->data.repeat.x);
+        case MPC_TYPE_AND:
+            for (i = 0; i < p->data.and.n; i++) {
+                if (!mpc_dfa_nullable(p->data.and.xs[i])) { return 0; }
+            }
+            return 1;
+        case MPC_TYPE_OR:
+            for (i = 0; i < p->data.or.n; i++) {
+                if (mpc_dfa_nullable(p->data.or.xs[i])) { return 1; }
+            }
+            return 0;
+        default: return 0;
+    }
+
+}
+
+static void mpc_dfa_first(mpc_parser_t *p, unsigned char *set) {
+
+    int i;
+
+    switch (p->type) {
+        case MPC_TYPE_EXPECT: mpc_dfa_first(p->data.expect.x, set); break;
+        case MPC_TYPE_MAYBE: mpc_dfa_first(p->data.not.x, set); break;
+        case MPC_TYPE_MANY:
+        case MPC_TYPE_MANY1: mpc_dfa_first(p->data.repeat.x, set); break;
+        case MPC_TYPE_AND:
+            for (i = 0; i < p->data.and.n; i++) {
+                mpc_dfa_first(p->data.and.xs[i], set);
+                if (!mpc_dfa_nullable(p->data.and.xs[i])) { break; }
+            }
+            break;
+        case MPC_TYPE_OR:
+            for (i = 0; i < p->data.or.n; i++) { mpc_dfa_first(p->data.or.xs[i], set); }
+            break;
+        default: mpc_dfa_set_of(p, set); break;
+    }
+
+}
+
+/*
+** Checks that p is built only from parsers the
+** DFA understands and that, with follow being
+** the bytes which may come after it, the next
+** byte always picks the path the combinators
+** would take.
+*/
+static int mpc_dfa_check(mpc_parser_t *p, const unsigned char *follow) {
+
+    int i;
+    unsigned char f[32], g[32];
+
+    if (p->retained) { return 0; }
+
+    switch (p->type) {
+
+        case MPC_TYPE_ANY:
+        case MPC_TYPE_SINGLE:
+        case MPC_TYPE_RANGE:
+        case MPC_TYPE_ONEOF:
+        case MPC_TYPE_NONEOF: return 1;
+
+        case MPC_TYPE_LIFT: return p->data.lift.lf == mpcf_ctor_str;
+        case MPC_TYPE_EXPECT: return mpc_dfa_check(p->data.expect.x, follow);
+
+        case MPC_TYPE_MAYBE:
+            if (p->data.not.lf != mpcf_ctor_str) { return 0; }
+            memset(f, 0, 32);
+            mpc_dfa_first(p->data.not.x, f);
+            if (mpc_dfa_set_meets(f, follow)) { return 0; }
+            return mpc_dfa_check(p->data.not.x, follow);
+
+        case MPC_TYPE_MANY:
+        case MPC_TYPE_MANY1:
+            if (p->data.repeat.f != mpcf_strfold) { return 0; }
+            if (mpc_dfa_nullable(p->data.repeat.x)) { return 0; }
+            memset(f, 0, 32);
+            mpc_dfa_first(p->data.repeat.x, f);
+            if (mpc_dfa_set_meets(f, follow)) { return 0; }
+            mpc_dfa_set_union(f, follow);
+            return mpc_dfa_check(p->data.repeat.x, f);
+
+        case MPC_TYPE_AND:
+            if (p->data.and.f != mpcf_strfold) { return 0; }
+            memcpy(f, follow, 32);
+            for (i = p->data.and.n-1; i >= 0; i--) {
+                if (!mpc_dfa_check(p->data.and.xs[i], f)) { return 0; }
+                if (!mpc_dfa_nullable(p->data.and.xs[i])) { memset(f, 0, 32); }
+                mpc_dfa_first(p->data.and.xs[i], f);
+            }
+            return 1;
+
+        case MPC_TYPE_OR:
+            memset(g, 0, 32);
+            for (i = 0; i < p->data.or.n; i++) {
+                if (i < p->data.or.n-1 && mpc_dfa_nullable(p->data.or.xs[i])) { return 0; }
+                memset(f, 0, 32);
+                mpc_dfa_first(p->data.or.xs[i], f);
+                if (mpc_dfa_set_meets(f, g)) { return 0; }
+                mpc_dfa_set_union(g, f);
+                if (!mpc_dfa_check(p->data.or.xs[i], follow)) { return 0; }
+            }
+            if (p->data.or.n > 0 && mpc_dfa_nullable(p->data.or.xs[p->data.or.n-1])) {
+                return !mpc_dfa_set_meets(g, follow);
+            }
+            return 1;
+
+        default: return 0;
+    }
+
+}
+
+static int mpc_nfa_new(mpc_dfa_t *d, int type) {
+    d->nfa_num++;
+    d->nfa = realloc(d->nfa, sizeof(mpc_nfa_t) * d->nfa_num);
+    d->nfa[d->nfa_num-1].type = type;
+    d->nfa[d->nfa_num-1].out = -1;
+    d->nfa[d->nfa_num-1].out1 = -1;
+    memset(d->nfa[d->nfa_num-1].set, 0, 32);
+    return d->nfa_num-1;
+}
+
+/*
+** Builds the NFA fragment for p and returns its
+** start. The fragment ends in the empty state
+** put in end, whose `out` is still unset.
+*/
+static int mpc_nfa_build(mpc_dfa_t *d, mpc_parser_t *p, int *end) {
+
+    int i, s, e, a, b, t;
+
+    switch (p->type) {
+
+        case MPC_TYPE_EXPECT: return mpc_nfa_build(d, p->data.expect.x, end);
+
+        case MPC_TYPE_LIFT:
+            s = mpc_nfa_new(d, MPC_NFA_EMPTY);
+            *end = s;
+            return s;
+
+        case MPC_TYPE_MAYBE:
+        case MPC_TYPE_MANY:
+        case MPC_TYPE_MANY1:
+            a = mpc_nfa_build(d, p->type == MPC_TYPE_MAYBE ? p->data.not.x : p->data.repeat.x, &b);
+            e = mpc_nfa_new(d, MPC_NFA_EMPTY);
+            s = mpc_nfa_new(d, MPC_NFA_SPLIT);
+            d->nfa[s].out = a;
+            d->nfa[s].out1 = e;
+            d->nfa[b].out = p->type == MPC_TYPE_MAYBE ? e : s;
+            *end = e;
+            return p->type == MPC_TYPE_MANY1 ? a : s;
+
+        case MPC_TYPE_AND:
+            s = mpc_nfa_build(d, p->data.and.xs[0], &e);
+            for (i = 1; i < p->data.and.n; i++) {
+                a = mpc_nfa_build(d, p->data.and.xs[i], &b);
+                d->nfa[e].out = a;
+                e = b;
+            }
+            *end = e;
+            return s;
+
+        case MPC_TYPE_OR:
+            e = mpc_nfa_new(d, MPC_NFA_EMPTY);
+            s = -1;
+            for (i = p->data.or.n-1; i >= 0; i--) {
+                a = mpc_nfa_build(d, p->data.or.xs[i], &b);
+                d->nfa[b].out = e;
+                if (s == -1) { s = a; continue; }
+                t = mpc_nfa_new(d, MPC_NFA_SPLIT);
+                d->nfa[t].out = a;
+                d->nfa[t].out1 = s;
+                s = t;
+            }
+            *end = e;
+            return s == -1 ? e : s;
+
+        default:
+            s = mpc_nfa_new(d, MPC_NFA_SET);
+            mpc_dfa_set_of(p, d->nfa[s].set);
+            e = mpc_nfa_new(d, MPC_NFA_EMPTY);
+            d->nfa[s].out = e;
+            *end = e;
+            return s;
+    }
+
+}
+
+static int mpc_dfa_compare(const void *x, const void *y) {
+    return *(const int*)x - *(const int*)y;
+}
+
+/*
+** Replaces the n NFA states in todo with the
+** sorted consuming and matching states reached
+** from them by empty moves, returning how many.
+*/
+static int mpc_dfa_closure(mpc_dfa_t *d, int n) {
+
+    int k, m = 0, stack = n;
+
+    d->gen++;
+    for (k = 0; k < n; k++) { d->seen[d->todo[k]] = d->gen; }
+
+    while (stack) {
+        k = d->todo[--stack];
+        switch (d->nfa[k].type) {
+            case MPC_NFA_SET:
+            case MPC_NFA_MATCH: d->next[m++] = k; break;
+            case MPC_NFA_SPLIT:
+                if (d->seen[d->nfa[k].out1] != d->gen) {
+                    d->seen[d->nfa[k].out1] = d->gen;
+                    d->todo[stack++] = d->nfa[k].out1;
+                }
+            /* fallthrough */
+            case MPC_NFA_EMPTY:
+                if (d->seen[d->nfa[k].out] != d->gen) {
+                    d->seen[d->nfa[k].out] = d->gen;
+                    d->todo[stack++] = d->nfa[k].out;
+                }
+                break;
+        }
+    }
+
+    qsort(d->next, m, sizeof(int), mpc_dfa_compare);
+    return m;
+}
+
+/* Finds or adds the DFA state for the m NFA states in next */
+static int mpc_dfa_state(mpc_dfa_t *d, int m) {
+
+    int i, k;
+
+    for (i = 0; i < d->states_num; i++) {
+        if (d->subsets_len[i] == m &&
+                memcmp(d->subsets + i * d->nfa_num, d->next, sizeof(int) * m) == 0) {
+            return i;
+        }
+    }
+
+    if (d->states_num == MPC_DFA_MAX) { return -1; }
+
+    if (d->states_num == d->states_slots) {
+        d->states_slots = d->states_slots * 2;
+        d->trans = realloc(d->trans, sizeof(int) * 256 * d->states_slots);
+        d->accept = realloc(d->accept, d->states_slots);
+        d->subsets = realloc(d->subsets, sizeof(int) * d->nfa_num * d->states_slots);
+        d->subsets_len = realloc(d->subsets_len, sizeof(int) * d->states_slots);
+    }
+
+    i = d->states_num++;
+    for (k = 0; k < 256; k++) { d->trans[i * 256 + k] = i == 0 ? 0 : -1; }
+    memcpy(d->subsets + i * d->nfa_num, d->next, sizeof(int) * m);
+    d->subsets_len[i] = m;
+    d->accept[i] = 0;
+    for (k = 0; k < m; k++) {
+        if (d->nfa[d->next[k]].type == MPC_NFA_MATCH) { d->accept[i] = 1; }
+    }
+
+    return i;
+}
+
+/* Works out the move from state s on c, -1 once the DFA is full */
+static int mpc_dfa_step(mpc_dfa_t *d, int s, unsigned char c) {
+
+    int k, x, n = 0;
+    int *subset = d->subsets + s * d->nfa_num;
+
+    for (k = 0; k < d->subsets_len[s]; k++) {
+        x = subset[k];
+        if (d->nfa[x].type == MPC_NFA_SET && mpc_dfa_set_has(d->nfa[x].set, c)) {
+            d->todo[n++] = d->nfa[x].out;
+        }
+    }
+
+    x = mpc_dfa_state(d, mpc_dfa_closure(d, n));
+    if (x >= 0) { d->trans[s * 256 + c] = x; }
+    return x;
+}
+
+static void mpc_dfa_delete(mpc_dfa_t *d) {
+    free(d->nfa);
+    free(d->trans);
+    free(d->accept);
+    free(d->subsets);
+    free(d->subsets_len);
+    free(d->seen);
+    free(d->todo);
+    free(d->next);
+    free(d);
+}
+
+/* Compiles p to a DFA, or returns NULL if it cannot be matched by one */
+static mpc_dfa_t *mpc_dfa_new(mpc_parser_t *p) {
+
+    int start, end, k, s, c;
+    unsigned char follow[32], any[32];
+    mpc_dfa_t *d;
+
+    memset(follow, 0, 32);
+    if (!mpc_dfa_check(p, follow)) { return NULL; }
+
+    d = malloc(sizeof(mpc_dfa_t));
+    d->nfa_num = 0;
+    d->nfa = NULL;
+
+    start = mpc_nfa_build(d, p, &end);
+    k = mpc_nfa_new(d, MPC_NFA_MATCH);
+    d->nfa[end].out = k;
+
+    d->gen = 0;
+    d->seen = calloc(d->nfa_num, sizeof(int));
+    d->todo = malloc(sizeof(int) * d->nfa_num);
+    d->next = malloc(sizeof(int) * d->nfa_num);
+
+    d->states_num = 0;
+    d->states_slots = 4;
+    d->trans = malloc(sizeof(int) * 256 * d->states_slots);
+    d->accept = malloc(d->states_slots);
+    d->subsets = malloc(sizeof(int) * d->nfa_num * d->states_slots);
+    d->subsets_len = malloc(sizeof(int) * d->states_slots);
+
+    mpc_dfa_state(d, 0);
+    d->todo[0] = start;
+    k = mpc_dfa_closure(d, 1);
+    mpc_dfa_state(d, k);
+
+    /* Bytes no NFA state consumes always lead to the dead state */
+    memset(any, 0, 32);
+    for (k = 0; k < d->nfa_num; k++) {
+        if (d->nfa[k].type == MPC_NFA_SET) { mpc_dfa_set_union(any, d->nfa[k].set); }
+    }
+
+    /* New states are appended as they are found, so this visits them all */
+    for (s = 1; s < d->states_num; s++) {
+        d->trans[s * 256] = 0;
+        for (c = 1; c < 256; c++) {
+            if (!mpc_dfa_set_has(any, c)) {
+                d->trans[s * 256 + c] = 0;
+            } else if (mpc_dfa_step(d, s, c) < 0) {
+                mpc_dfa_delete(d);
+                return NULL;
+            }
+        }
+    }
+
+    /* Only the table is needed from here on */
+    free(d->subsets);
+    free(d->subsets_len);
+    free(d->seen);
+    free(d->todo);
+    free(d->next);
+    d->subsets = NULL;
+    d->subsets_len = NULL;
+    d->seen = NULL;
+    d->todo = NULL;
+    d->next = NULL;
+
+    return d;
+}
+
+/*
+** Matches the longest token the DFA accepts at
+** the current position of a string input.
+** Returns -1 if the input holds a zero byte,
+** leaving the input as it was for the
+** combinators to match instead.
+*/
+static int mpc_input_dfa(mpc_input_t *i, mpc_dfa_t *d, char **o) {
+
+    const unsigned char *s = (const unsigned char*)i->string;
+    int start = i->state.pos;
+    int pos = start, end = -1;
+    int t = 1, n;
+
+    if (d->accept[t]) { end = pos; }
+
+    while (pos < i->length) {
+        if (s[pos] == '\0') { return -1; }
+        n = d->trans[t * 256 + s[pos]];
+        if (n == 0) { break; }
+        t = n;
+        pos++;
+        if (d->accept[t]) { end = pos; }
+    }
+
+    if (end < 0) { return 0; }
+
+    for (pos = start; pos < end; pos++) {
+        i->state.col++;
+        if (s[pos] == '\n') {
+            i->state.col = 0;
+            i->state.row++;
+        }
+    }
+
+    if (end > start) { i->last = s[end-1]; }
+    i->state.pos = end;
+
+    *o = malloc(end - start + 1);
+    memcpy(*o, s + start, end - start);
+    (*o)[end - start] = '\0';
+
+    return 1;
+}
+
+/*
+ ** Spans
+ */
+
+/*
+** A `many` folding single characters into a
+** string, such as the whitespace after every
+** token, would push one malloc'd character per
+** step and then concatenate them. Instead it
+** matches its characters in place, without
+** outputs, and copies the span they cover out
+** of the input in one go.
+*/
+
+static int mpc_input_span_char(mpc_input_t *i, mpc_parser_t *p) {
+    switch (p->type) {
+        case MPC_TYPE_ANY:     return mpc_input_any(i, NULL);
+        case MPC_TYPE_SINGLE:  return mpc_input_char(i, p->data.single.x, NULL);
+        case MPC_TYPE_RANGE:   return mpc_input_range(i, p->data.range.x, p->data.range.y, NULL);
+        case MPC_TYPE_ONEOF:   return mpc_input_oneof(i, p->data.string.x, NULL);
+        case MPC_TYPE_NONEOF:  return mpc_input_noneof(i, p->data.string.x, NULL);
+        case MPC_TYPE_SATISFY: return mpc_input_satisfy(i, p->data.satisfy.f, NULL);
+        default: return 0;
+    }
+}
+
+/*
+** Matches x as many times as it will go when x
+** is a character parser under any number of
+** expects, putting the span matched in o and
+** the error x ended on in e. Returns how many
+** characters were matched, or -1 if x is some
+** other parser.
+*/
+static int mpc_input_span(mpc_input_t *i, mpc_parser_t *x, char **o, mpc_err_t **e) {
+
+    int n = 0, max = 0, start = i->state.pos;
+    const char *expected = NULL;
+
+    while (x->type == MPC_TYPE_EXPECT && !x->memo) {
+        if (expected == NULL) { expected = x->data.expect.m; }
+        x = x->data.expect.x;
+    }
+
+    if (x->memo || x->type < MPC_TYPE_ANY || x->type > MPC_TYPE_SATISFY) { return -1; }
+
+    *o = NULL;
+
+    while (mpc_input_span_char(i, x)) {
+        if (i->type != MPC_INPUT_STRING) {
+            if (n + 1 >= max) {
+                max = max ? max * 2 : 16;
+                *o = realloc(*o, max);
+            }
+            (*o)[n] = i->last;
+        }
+        n++;
+    }
+
+    if (i->type == MPC_INPUT_STRING) {
+        *o = malloc(n + 1);
+        memcpy(*o, i->string + start, n);
+    } else if (*o == NULL) {
+        *o = malloc(1);
+    }
+    (*o)[n] = '\0';
+
+    *e = expected ?
+        mpc_input_err_new(i, expected) :
+        mpc_input_err_fail(i, "Incorrect Input");
+
+    return n;
+}
+
+/*
+ ** Memo Type
+ */
+
+/*
+** The result of a memoized parser at a position,
+** with the state it left the input in. In exact
+** mode errors also keeps the errors the parser
+** added to the stack on the way.
+*/
+typedef struct {
+    mpc_parser_t *parser;
+    int pos;
+    int success;
+    mpc_state_t state;
+    char last;
+    mpc_val_t *output;
+    mpc_err_t *error;
+    mpc_err_t *errors;
+    int cost;
+} mpc_memo_t;
+
 /*
  ** Stack Type
  */
@@ -738,6 +1576,10 @@ typedef struct {
     int parsers_slots;
     mpc_parser_t **parsers;
     int *states;
+    int *starts;
+    mpc_err_t **saved;
+    int popped_start;
+    mpc_err_t *popped_saved;
 
     int results_num;
     int results_slots;
@@ -746,26 +1588,81 @@ typedef struct {
 
     mpc_err_t *err;
 
+    int memo_num;
+    int memo_slots;
+    int memo_cost;
+    mpc_memo_t *memo;
+
 } mpc_stack_t;
 
-static mpc_stack_t *mpc_stack_new(const char *filename) {
-    mpc_stack_t *s = malloc(sizeof(mpc_stack_t));
+/*
+** Like the marks, the stacks grow geometrically,
+** never shrink during a parse, and the last one
+** used on a thread is kept for the next parse.
+*/
+
+#define MPC_STACK_MIN 64
+
+#ifdef MPC_THREAD_LOCAL
+static MPC_THREAD_LOCAL mpc_stack_t *mpc_stack_cache = NULL;
+#endif
+
+static mpc_stack_t *mpc_stack_new(mpc_input_t *i) {
+
+    mpc_stack_t *s = NULL;
+
+#ifdef MPC_THREAD_LOCAL
+    s = mpc_stack_cache;
+    mpc_stack_cache = NULL;
+#endif
+
+    if (s == NULL) {
+        s = malloc(sizeof(mpc_stack_t));
+        s->parsers_slots = 0;
+        s->parsers = NULL;
+        s->states = NULL;
+        s->starts = NULL;
+        s->saved = NULL;
+        s->results_slots = 0;
+        s->results = NULL;
+        s->returns = NULL;
+    }
 
     s->parsers_num = 0;
-    s->parsers_slots = 0;
-    s->parsers = NULL;
-    s->states = NULL;
-
     s->results_num = 0;
-    s->results_slots = 0;
-    s->results = NULL;
-    s->returns = NULL;
 
-    s->err = mpc_err_fail(filename, mpc_state_invalid(), "Unknown Error");
+    s->err = i->fast ? &mpc_err_marker : mpc_err_fail(i->filename, mpc_state_invalid(), "Unknown Error");
+
+    s->memo_num = 0;
+    s->memo_slots = 0;
+    s->memo_cost = 0;
+    s->memo = NULL;
 
     return s;
 }
 
+static void mpc_memo_delete(mpc_memo_t *m) {
+    if (m->success) { mpc_ast_delete(m->output); }
+    if (m->error)   { mpc_err_delete(m->error); }
+    if (m->errors)  { mpc_err_delete(m->errors); }
+}
+
+static void mpc_stack_memo_delete(mpc_stack_t *s) {
+
+    int k;
+
+    for (k = 0; k < s->memo_slots; k++) {
+        if (s->memo[k].parser == NULL) { continue; }
+        mpc_memo_delete(&s->memo[k]);
+    }
+
+    free(s->memo);
+    s->memo_num = 0;
+    s->memo_slots = 0;
+    s->memo_cost = 0;
+    s->memo = NULL;
+}
+
 static void mpc_stack_err(mpc_stack_t *s, mpc_err_t* e) {
     mpc_err_t *errs[2];
     errs[0] = s->err;
@@ -773,6 +1670,16 @@ static void mpc_stack_err(mpc_stack_t *s, mpc_err_t* e) {
     s->err = mpc_err_or(errs, 2);
 }
 
+static void mpc_stack_free(mpc_stack_t *s) {
+    free(s->parsers);
+    free(s->states);
+    free(s->starts);
+    free(s->saved);
+    free(s->results);
+    free(s->returns);
+    free(s);
+}
+
 static int mpc_stack_terminate(mpc_stack_t *s, mpc_result_t *r) {
     int success = s->returns[0];
 
@@ -784,49 +1691,64 @@ static int mpc_stack_terminate(mpc_stack_t *s, mpc_result_t *r) {
         r->error = s->err;
     }
 
-    free(s->parsers);
-    free(s->states);
-    free(s->results);
-    free(s->returns);
-    free(s);
+    mpc_stack_memo_delete(s);
+
+#ifdef MPC_THREAD_LOCAL
+    if (mpc_stack_cache == NULL &&
+            s->parsers_slots <= MPC_CACHE_MAX &&
+            s->results_slots <= MPC_CACHE_MAX) {
+        mpc_stack_cache = s;
+        return success;
+    }
+#endif
 
+    mpc_stack_free(s);
     return success;
 }
 
+/* Frees the stack and mark arrays the calling thread keeps for its next parse */
+void mpc_thread_cleanup(void) {
+#ifdef MPC_THREAD_LOCAL
+    if (mpc_stack_cache) { mpc_stack_free(mpc_stack_cache); }
+    free(mpc_input_cache_marks);
+    free(mpc_input_cache_lasts);
+    mpc_stack_cache = NULL;
+    mpc_input_cache_slots = 0;
+    mpc_input_cache_marks = NULL;
+    mpc_input_cache_lasts = NULL;
+#endif
+}
+
 /* Stack Parser Stuff */
 
 static void mpc_stack_set_state(mpc_stack_t *s, int x) {
     s->states[s->parsers_num-1] = x;
 }
 
-static void mpc_stack_parsers_reserve_more(mpc_stack_t *s) {
+static void mpc_stack_parsers_reserve(mpc_stack_t *s) {
     if (s->parsers_num > s->parsers_slots) {
-        s->parsers_slots = ceil((s->parsers_slots+1) * 1.5);
-        s->parsers = realloc(s->parsers, sizeof(mpc_parser_t*) * s->parsers_slots);
-        s->states = realloc(s->states, sizeof(int) * s->parsers_slots);
-    }
-}
-
-static void mpc_stack_parsers_reserve_less(mpc_stack_t *s) {
-    if (s->parsers_slots > pow(s->parsers_num+1, 1.5)) {
-        s->parsers_slots = floor((s->parsers_slots-1) * (1.0/1.5));
+        s->parsers_slots = s->parsers_slots ? s->parsers_slots * 2 : MPC_STACK_MIN;
         s->parsers = realloc(s->parsers, sizeof(mpc_parser_t*) * s->parsers_slots);
         s->states = realloc(s->states, sizeof(int) * s->parsers_slots);
+        s->starts = realloc(s->starts, sizeof(int) * s->parsers_slots);
+        s->saved = realloc(s->saved, sizeof(mpc_err_t*) * s->parsers_slots);
     }
 }
 
 static void mpc_stack_pushp(mpc_stack_t *s, mpc_parser_t *p) {
     s->parsers_num++;
-    mpc_stack_parsers_reserve_more(s);
+    mpc_stack_parsers_reserve(s);
     s->parsers[s->parsers_num-1] = p;
     s->states[s->parsers_num-1] = 0;
+    s->starts[s->parsers_num-1] = -1;
 }
 
 static void mpc_stack_popp(mpc_stack_t *s, mpc_parser_t **p, int *st) {
     *p = s->parsers[s->parsers_num-1];
     *st = s->states[s->parsers_num-1];
+    s->popped_start = s->starts[s->parsers_num-1];
+    s->popped_saved = s->saved[s->parsers_num-1];
     s->parsers_num--;
-    mpc_stack_parsers_reserve_less(s);
 }
 
 static void mpc_stack_peepp(mpc_stack_t *s, mpc_parser_t **p, int *st) {
@@ -852,17 +1774,9 @@ static mpc_result_t mpc_result_out(mpc_val_t *x) {
     return r;
 }
 
-static void mpc_stack_results_reserve_more(mpc_stack_t *s) {
+static void mpc_stack_results_reserve(mpc_stack_t *s) {
     if (s->results_num > s->results_slots) {
-        s->results_slots = ceil((s->results_slots + 1) * 1.5);
-        s->results = realloc(s->results, sizeof(mpc_result_t) * s->results_slots);
-        s->returns = realloc(s->returns, sizeof(int) * s->results_slots);
-    }
-}
-
-static void mpc_stack_results_reserve_less(mpc_stack_t *s) {
-    if ( s->results_slots > pow(s->results_num+1, 1.5)) {
-        s->results_slots = floor((s->results_slots-1) * (1.0/1.5));
+        s->results_slots = s->results_slots ? s->results_slots * 2 : MPC_STACK_MIN;
         s->results = realloc(s->results, sizeof(mpc_result_t) * s->results_slots);
         s->returns = realloc(s->returns, sizeof(int) * s->results_slots);
     }
@@ -870,7 +1784,7 @@ static void mpc_stack_results_reserve_less(mpc_stack_t *s) {
 
 static void mpc_stack_pushr(mpc_stack_t *s, mpc_result_t x, int r) {
     s->results_num++;
-    mpc_stack_results_reserve_more(s);
+    mpc_stack_results_reserve(s);
     s->results[s->results_num-1] = x;
     s->returns[s->results_num-1] = r;
 }
@@ -880,7 +1794,6 @@ static int mpc_stack_popr(mpc_stack_t *s, mpc_result_t *x) {
     *x = s->results[s->results_num-1];
     r = s->returns[s->results_num-1];
     s->results_num--;
-    mpc_stack_results_reserve_less(s);
     return r;
 }
 
@@ -936,6 +1849,177 @@ static mpc_err_t *mpc_stack_merger_err(mpc_stack_t *s, int n) {
     return x;
 }
 
+/* Stack Memo Stuff */
+
+/*
+** Packrat parsing. Parsers marked with `memo`
+** (the rules of a grammar made by mpca_lang with
+** MPCA_LANG_PACKRAT) remember their result at
+** each position they are tried, so a rule shared
+** by several alternatives of an `or` is only
+** parsed once there. Their outputs are ASTs. In
+** an arena, where no node is freed on its own,
+** the table and every hit share the nodes below
+** the root, so a hit costs the same however big
+** the tree is. Packrat parses made outside of an
+** arena run in a private one for this, and
+** otherwise the ASTs are copied in and out.
+**
+** Results are only kept while backtracking is on,
+** as predictive parsers behave differently. Once
+** the table holds MPC_MEMO_MAX entries and copied
+** AST nodes, the entries at the earlier half of
+** its positions are dropped, since the parse has
+** usually moved on from those.
+**
+** Keeping errors exact means recording every
+** error a rule adds, so the first pass does not.
+** If it fails after a hit it is run again by
+** mpc_parse_input with errors kept in the table.
+*/
+
+#define MPC_MEMO_MAX (1 << 20)
+
+static mpc_ast_t *mpc_ast_copy(mpc_ast_t *a, int *cost);
+static mpc_ast_t *mpc_ast_share(mpc_ast_t *a, int *cost);
+
+static mpc_memo_t *mpc_stack_memo_slot(mpc_stack_t *s, mpc_parser_t *p, int pos) {
+
+    unsigned long h = ((unsigned long)p >> 4) * 31 + (unsigned long)pos;
+    unsigned long k = (h * 2654435761UL) & (s->memo_slots-1);
+
+    while (s->memo[k].parser != NULL &&
+            !(s->memo[k].parser == p && s->memo[k].pos == pos)) {
+        k = (k + 1) & (s->memo_slots-1);
+    }
+
+    return &s->memo[k];
+}
+
+static void mpc_stack_memo_reserve(mpc_stack_t *s) {
+
+    int k, slots;
+    mpc_memo_t *memo;
+
+    if ((s->memo_num+1) * 2 <= s->memo_slots) { return; }
+
+    memo = s->memo;
+    slots = s->memo_slots;
+
+    s->memo_slots = slots ? slots * 2 : 64;
+    s->memo = calloc(s->memo_slots, sizeof(mpc_memo_t));
+
+    for (k = 0; k < slots; k++) {
+        if (memo[k].parser == NULL) { continue; }
+        *mpc_stack_memo_slot(s, memo[k].parser, memo[k].pos) = memo[k];
+    }
+
+    free(memo);
+}
+
+/* Drops the entries at the earlier half of the positions in the table */
+static void mpc_stack_memo_evict(mpc_stack_t *s) {
+
+    int k, n = 0, cut;
+    int *pos = malloc(sizeof(int) * s->memo_num);
+    mpc_memo_t *memo = s->memo;
+
+    for (k = 0; k < s->memo_slots; k++) {
+        if (memo[k].parser != NULL) { pos[n++] = memo[k].pos; }
+    }
+
+    qsort(pos, n, sizeof(int), mpc_dfa_compare);
+    cut = pos[n / 2] > pos[0] ? pos[n / 2] : pos[0] + 1;
+    free(pos);
+
+    s->memo = calloc(s->memo_slots, sizeof(mpc_memo_t));
+    s->memo_num = 0;
+    s->memo_cost = 0;
+
+    for (k = 0; k < s->memo_slots; k++) {
+        if (memo[k].parser == NULL) { continue; }
+        if (memo[k].pos < cut) { mpc_memo_delete(&memo[k]); continue; }
+        *mpc_stack_memo_slot(s, memo[k].parser, memo[k].pos) = memo[k];
+        s->memo_num++;
+        s->memo_cost += memo[k].cost;
+    }
+
+    free(memo);
+}
+
+/* Pushes the remembered result of p if there is one */
+static int mpc_stack_memo_get(mpc_stack_t *s, mpc_input_t *i, mpc_parser_t *p) {
+
+    int st;
+    mpc_memo_t *m;
+
+    if (s->memo_num == 0) { return 0; }
+
+    m = mpc_stack_memo_slot(s, p, i->state.pos);
+    if (m->parser == NULL) { return 0; }
+
+    if (m->errors) { mpc_stack_err(s, mpc_err_copy(m->errors)); }
+
+    mpc_stack_popp(s, &p, &st);
+    if (m->success) {
+        mpc_stack_pushr(s, mpc_result_out(mpc_ast_share(m->output, NULL)), 1);
+    } else {
+        mpc_stack_pushr(s, mpc_result_err(mpc_err_copy(m->error)), 0);
+    }
+
+    mpc_input_jump(i, m->state, m->last);
+    return 1;
+}
+
+static void mpc_stack_memo_start(mpc_stack_t *s, mpc_input_t *i) {
+
+    s->starts[s->parsers_num-1] = i->state.pos;
+
+    if (!i->fast) {
+        s->saved[s->parsers_num-1] = s->err;
+        s->err = mpc_err_fail(i->filename, mpc_state_invalid(), "Unknown Error");
+    }
+
+}
+
+/* Remembers the result just pushed by the parser just popped */
+static void mpc_stack_memo_put(mpc_stack_t *s, mpc_input_t *i, mpc_parser_t *p) {
+
+    int pos = s->popped_start;
+    mpc_result_t r;
+    mpc_memo_t *m;
+    mpc_err_t *errs[2];
+    mpc_err_t *errors = NULL;
+    int success = mpc_stack_peekr(s, &r);
+    int cost = 1;
+
+    if (pos < 0) { return; }
+
+    if (!i->fast) {
+        errors = mpc_err_copy(s->err);
+        errs[0] = s->popped_saved;
+        errs[1] = s->err;
+        s->err = mpc_err_or(errs, 2);
+    }
+
+    if (s->memo_cost >= MPC_MEMO_MAX) { mpc_stack_memo_evict(s); }
+
+    mpc_stack_memo_reserve(s);
+    m = mpc_stack_memo_slot(s, p, pos);
+    m->parser = p;
+    m->pos = pos;
+    m->success = success;
+    m->state = i->state;
+    m->last = i->last;
+    m->output = success ? mpc_ast_share(r.output, &cost) : NULL;
+    m->error = success ? NULL : mpc_err_copy(r.error);
+    m->errors = errors;
+    m->cost = cost;
+
+    s->memo_num++;
+    s->memo_cost += cost;
+}
+
 /*
  ** This is rather pleasant. The core parsing routine
  ** is written in about 200 lines of C.
@@ -958,19 +2042,21 @@ static mpc_err_t *mpc_stack_merger_err(mpc_stack_t *s, int n) {
  */
 
 #define MPC_CONTINUE(st, x) mpc_stack_set_state(stk, st); mpc_stack_pushp(stk, x); continue
-#define MPC_SUCCESS(x) mpc_stack_popp(stk, &p, &st); mpc_stack_pushr(stk, mpc_result_out(x), 1); continue
-#define MPC_FAILURE(x) mpc_stack_popp(stk, &p, &st); mpc_stack_pushr(stk, mpc_result_err(x), 0); continue
-#define MPC_PRIMATIVE(x, f) if (f) { MPC_SUCCESS(x); } else { MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Incorrect Input")); }
+#define MPC_SUCCESS(x) mpc_stack_popp(stk, &p, &st); mpc_stack_pushr(stk, mpc_result_out(x), 1); if (p->memo) { mpc_stack_memo_put(stk, i, p); } continue
+#define MPC_FAILURE(x) mpc_stack_popp(stk, &p, &st); mpc_stack_pushr(stk, mpc_result_err(x), 0); if (p->memo) { mpc_stack_memo_put(stk, i, p); } continue
+#define MPC_PRIMATIVE(x, f) if (f) { MPC_SUCCESS(x); } else { MPC_FAILURE(mpc_input_err_fail(i, "Incorrect Input")); }
 
-int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
 
     /* Stack */
     int st = 0;
     mpc_parser_t *p = NULL;
-    mpc_stack_t *stk = mpc_stack_new(i->filename);
+    mpc_stack_t *stk = mpc_stack_new(i);
 
     /* Variables */
     char *s;
+    int x;
+    mpc_err_t *e;
     mpc_result_t r;
 
     /* Go! */
@@ -980,6 +2066,11 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
 
         mpc_stack_peepp(stk, &p, &st);
 
+        if (st == 0 && p->memo && i->backtrack == 1) {
+            if (mpc_stack_memo_get(stk, i, p)) { continue; }
+            mpc_stack_memo_start(stk, i);
+        }
+
         switch (p->type) {
 
             /* Basic Parsers */
@@ -994,9 +2085,9 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
 
                                      /* Other parsers */
 
-            case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Parser Undefined!"));      
+            case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_input_err_fail(i, "Parser Undefined!"));      
             case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
-            case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i->filename, i->state, p->data.fail.m));
+            case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_input_err_fail(i, p->data.fail.m));
             case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
             case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
             case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_state_copy(i->state));
@@ -1005,7 +2096,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
                                      if (mpc_input_anchor(i, p->data.anchor.f)) {
                                          MPC_SUCCESS(NULL);
                                      } else {
-                                         MPC_FAILURE(mpc_err_new(i->filename, i->state, "anchor", mpc_input_peekc(i)));
+                                         MPC_FAILURE(mpc_input_err_new(i, "anchor"));
                                      }
 
                                      /* Application Parsers */
@@ -1017,7 +2108,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
                                              MPC_SUCCESS(r.output);
                                          } else {
                                              mpc_err_delete(r.error); 
-                                             MPC_FAILURE(mpc_err_new(i->filename, i->state, p->data.expect.m, mpc_input_peekc(i)));
+                                             MPC_FAILURE(mpc_input_err_new(i, p->data.expect.m));
                                          }
                                      }
 
@@ -1046,6 +2137,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
                                      if (st == 1) {
                                          mpc_input_backtrack_enable(i);
                                          mpc_stack_popp(stk, &p, &st);
+                                         if (p->memo) { mpc_stack_memo_put(stk, i, p); }
                                          continue;
                                      }
 
@@ -1059,7 +2151,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
                                          if (mpc_stack_popr(stk, &r)) {
                                              mpc_input_rewind(i);
                                              p->data.not.dx(r.output);
-                                             MPC_FAILURE(mpc_err_new(i->filename, i->state, "opposite", mpc_input_peekc(i)));
+                                             MPC_FAILURE(mpc_input_err_new(i, "opposite"));
                                          } else {
                                              mpc_input_unmark(i);
                                              mpc_stack_err(stk, r.error);
@@ -1081,6 +2173,11 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
                                      /* Repeat Parsers */
 
             case MPC_TYPE_MANY:
+                                     if (st == 0 && p->data.repeat.f == mpcf_strfold &&
+                                             mpc_input_span(i, p->data.repeat.x, &s, &e) >= 0) {
+                                         mpc_stack_err(stk, e);
+                                         MPC_SUCCESS(s);
+                                     }
                                      if (st == 0) { MPC_CONTINUE(st+1, p->data.repeat.x); }
                                      if (st >  0) {
                                          if (mpc_stack_peekr(stk, &r)) {
@@ -1093,6 +2190,15 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
                                      }
 
             case MPC_TYPE_MANY1:
+                                     if (st == 0 && p->data.repeat.f == mpcf_strfold &&
+                                             (x = mpc_input_span(i, p->data.repeat.x, &s, &e)) >= 0) {
+                                         if (x == 0) {
+                                             free(s);
+                                             MPC_FAILURE(mpc_err_many1(e));
+                                         }
+                                         mpc_stack_err(stk, e);
+                                         MPC_SUCCESS(s);
+                                     }
                                      if (st == 0) { MPC_CONTINUE(st+1, p->data.repeat.x); }
                                      if (st >  0) {
                                          if (mpc_stack_peekr(stk, &r)) {
@@ -1162,11 +2268,28 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
                                          if (st == p->data.and.n) { mpc_input_unmark(i); MPC_SUCCESS(mpc_stack_merger_out(stk, p->data.and.n, p->data.and.f)); }
                                      }
 
+                                     /* Compiled Parsers */
+
+            case MPC_TYPE_DFA:
+                                     if (st == 0 && i->type == MPC_INPUT_STRING && i->fast) {
+                                         x = mpc_input_dfa(i, p->data.dfa.d, &s);
+                                         if (x >  0) { MPC_SUCCESS(s); }
+                                         if (x == 0) { MPC_FAILURE(mpc_input_err_new(i, "regex")); }
+                                     }
+                                     if (st == 0) { MPC_CONTINUE(1, p->data.dfa.x); }
+                                     if (st == 1) {
+                                         if (mpc_stack_popr(stk, &r)) {
+                                             MPC_SUCCESS(r.output);
+                                         } else {
+                                             MPC_FAILURE(r.error);
+                                         }
+                                     }
+
                                      /* End */
 
             default:
 
-                                     MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Unknown Parser Type Id!"));
+                                     MPC_FAILURE(mpc_input_err_fail(i, "Unknown Parser Type Id!"));
         }
     }
 
@@ -1179,6 +2302,48 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
 #undef MPC_FAILURE
 #undef MPC_PRIMATIVE
 
+/* Only the thread parsing into an arena sees it as current */
+#ifdef MPC_THREAD_LOCAL
+static MPC_THREAD_LOCAL mpc_arena_t *mpc_arena_current = NULL;
+#else
+static mpc_arena_t *mpc_arena_current = NULL;
+#endif
+
+static int mpc_parse_packrat(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final);
+
+/*
+** The first run is in fast mode, where failures
+** only leave `mpc_err_marker` rather than an
+** error, regexes are matched by their DFA, and
+** memoized parsers leave none of the errors they
+** would have otherwise. So a parse which fails
+** is run again from the start in exact mode,
+** building each error and skipping the DFA,
+** which gives the message in full. This costs
+** nothing on success, and failing is the rare
+** case. Pipes cannot be read twice, so they are
+** always parsed in exact mode.
+*/
+int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
+
+    int x;
+    mpc_state_t state = i->state;
+    char last = i->last;
+
+    if (init->memo && mpc_arena_current == NULL) { return mpc_parse_packrat(i, init, final); }
+
+    x = mpc_parse_run(i, init, final);
+    if (x || !i->fast) { return x; }
+
+    mpc_err_delete(final->error);
+    mpc_input_jump(i, state, last);
+    i->fast = 0;
+    x = mpc_parse_run(i, init, final);
+    i->fast = 1;
+
+    return x;
+}
+
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
     int x;
     mpc_input_t *i = mpc_input_new_string(filename, string);
@@ -1191,6 +2356,10 @@ int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result
     int x;
     mpc_input_t *i = mpc_input_new_file(filename, file);
     x = mpc_parse_input(i, p, r);
+
+    /* Leave the file where the parse stopped, as reading it would have */
+    if (i->mapped) { fseek(file, i->state.pos, SEEK_SET); }
+
     mpc_input_delete(i);
     return x;
 }
@@ -1283,6 +2452,11 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
         case MPC_TYPE_OR:  mpc_undefine_or(p);  break;
         case MPC_TYPE_AND: mpc_undefine_and(p); break;
 
+        case MPC_TYPE_DFA:
+                                mpc_undefine_unretained(p->data.dfa.x, 0);
+                                mpc_dfa_delete(p->data.dfa.d);
+                                break;
+
         default: break;
     }
 
@@ -2007,6 +3181,17 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
     return out;
 }
 
+static mpc_parser_t *mpc_re_dfa(mpc_parser_t *a) {
+    mpc_parser_t *p;
+    mpc_dfa_t *d = mpc_dfa_new(a);
+    if (d == NULL) { return a; }
+    p = mpc_undefined();
+    p->type = MPC_TYPE_DFA;
+    p->data.dfa.d = d;
+    p->data.dfa.x = a;
+    return p;
+}
+
 mpc_parser_t *mpc_re(const char *re) {
 
     char *err_msg;
@@ -2057,6 +3242,8 @@ mpc_parser_t *mpc_re(const char *re) {
         mpc_err_delete(r.error);  
         free(err_msg);
         r.output = err_out;
+    } else {
+        r.output = mpc_re_dfa(r.output);
     }
 
     mpc_delete(RegexEnclose);
@@ -2257,13 +3444,24 @@ mpc_val_t *mpcf_snd_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 1)
 mpc_val_t *mpcf_trd_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 2); }
 
 mpc_val_t *mpcf_strfold(int n, mpc_val_t **xs) {
-    char *x = calloc(1, 1);
+
     int i;
+    size_t l = 0, k;
+    char *x;
+
+    for (i = 0; i < n; i++) { l += strlen(xs[i]); }
+
+    x = malloc(l + 1);
+    l = 0;
+
     for (i = 0; i < n; i++) {
-        x = realloc(x, strlen(x) + strlen(xs[i]) + 1);
-        strcat(x, xs[i]);
+        k = strlen(xs[i]);
+        memcpy(x + l, xs[i], k);
+        l += k;
         free(xs[i]);
     }
+
+    x[l] = '\0';
     return x;
 }
 
@@ -2370,6 +3568,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
     if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
     if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
     if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+    if (p->type == MPC_TYPE_DFA)      { mpc_print_unretained(p->data.dfa.x, 0); }
 
     if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
     if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
@@ -2471,6 +3670,139 @@ int mpc_test_pass(mpc_parser_t *p, const char *s, void *d,
 }
 
 
+/*
+ ** Arena
+ */
+
+/*
+** An arena hands out memory from large blocks
+** and gives it all back at once. While a parse
+** into an arena runs, the AST functions build
+** their nodes in it, with the tag and contents
+** laid out right after the node, and deleting
+** a node does nothing. Blocks are kept when the
+** arena is cleared, so a REPL which clears it
+** after each line stops allocating altogether.
+*/
+
+#define MPC_ARENA_BLOCK 65536
+
+typedef struct mpc_arena_block_t {
+    struct mpc_arena_block_t *next;
+    size_t size;
+    size_t used;
+} mpc_arena_block_t;
+
+struct mpc_arena_t {
+    mpc_arena_block_t *first;
+    mpc_arena_block_t *current;
+};
+
+mpc_arena_t *mpc_arena_new(void) {
+    mpc_arena_t *a = malloc(sizeof(mpc_arena_t));
+    a->first = NULL;
+    a->current = NULL;
+    return a;
+}
+
+void mpc_arena_clear(mpc_arena_t *a) {
+    mpc_arena_block_t *b;
+    for (b = a->first; b != NULL; b = b->next) { b->used = 0; }
+    a->current = a->first;
+}
+
+void mpc_arena_delete(mpc_arena_t *a) {
+    mpc_arena_block_t *b, *n;
+    for (b = a->first; b != NULL; b = n) {
+        n = b->next;
+        free(b);
+    }
+    free(a);
+}
+
+static void *mpc_arena_alloc(mpc_arena_t *a, size_t n) {
+
+    void *x;
+    mpc_arena_block_t *b;
+    size_t size;
+
+    n = (n + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+
+    while (a->current && a->current->used + n > a->current->size) {
+        a->current = a->current->next;
+    }
+
+    if (a->current == NULL) {
+        size = n > MPC_ARENA_BLOCK ? n : MPC_ARENA_BLOCK;
+        b = malloc(sizeof(mpc_arena_block_t) + size);
+        b->size = size;
+        b->used = 0;
+        b->next = a->first;
+        a->first = b;
+        a->current = b;
+    }
+
+    x = (char*)(a->current + 1) + a->current->used;
+    a->current->used += n;
+    return x;
+}
+
+/* The string s copied into the current arena */
+static char *mpc_arena_strdup(const char *s) {
+    char *x = mpc_arena_alloc(mpc_arena_current, strlen(s) + 1);
+    strcpy(x, s);
+    return x;
+}
+
+/*
+** Children arrays in an arena grow by doubling,
+** so a node with n children has room for n
+** rounded up to a power of two.
+*/
+static mpc_ast_t **mpc_arena_children(mpc_ast_t *a, int n) {
+
+    int slots = 1;
+    mpc_ast_t **xs;
+
+    while (slots < a->children_num) { slots *= 2; }
+    if (a->children_num > 0 && n <= slots) { return a->children; }
+
+    while (slots < n) { slots *= 2; }
+    xs = mpc_arena_alloc(mpc_arena_current, sizeof(mpc_ast_t*) * slots);
+    if (a->children_num) { memcpy(xs, a->children, sizeof(mpc_ast_t*) * a->children_num); }
+    return xs;
+}
+
+int mpc_parse_arena(const char *filename, const char *string, mpc_parser_t *p, mpc_arena_t *a, mpc_result_t *r) {
+    int x;
+    mpc_arena_t *outer = mpc_arena_current;
+    mpc_arena_current = a;
+    x = mpc_parse(filename, string, p, r);
+    mpc_arena_current = outer;
+    return x;
+}
+
+/*
+** A packrat parse outside of an arena runs in a private
+** one, so that its memo table can share nodes, and the
+** AST is copied out of it at the end. Nodes dropped
+** while parsing are only freed then too.
+*/
+static int mpc_parse_packrat(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
+    int x;
+    mpc_ast_t *a;
+    mpc_arena_t *arena = mpc_arena_new();
+    mpc_arena_current = arena;
+    x = mpc_parse_input(i, init, final);
+    mpc_arena_current = NULL;
+    if (x) {
+        a = final->output;
+        final->output = mpc_ast_copy(a, NULL);
+    }
+    mpc_arena_delete(arena);
+    return x;
+}
+
 /*
  ** AST
  */
@@ -2479,7 +3811,7 @@ void mpc_ast_delete(mpc_ast_t *a) {
 
     int i;
 
-    if (a == NULL) { return; }
+    if (a == NULL || mpc_arena_current) { return; }
     for (i = 0; i < a->children_num; i++) {
         mpc_ast_delete(a->children[i]);
     }
@@ -2491,7 +3823,60 @@ void mpc_ast_delete(mpc_ast_t *a) {
 
 }
 
+/* Deep copy of a, adding the number of nodes to cost if given */
+static mpc_ast_t *mpc_ast_copy(mpc_ast_t *a, int *cost) {
+
+    int i;
+    mpc_ast_t *r;
+
+    if (a == NULL) { return NULL; }
+    if (cost) { (*cost)++; }
+
+    r = mpc_ast_new(a->tag, a->contents);
+    r->state = a->state;
+
+    if (a->children_num && mpc_arena_current) {
+        r->children = mpc_arena_children(r, a->children_num);
+    } else if (a->children_num) {
+        r->children = malloc(sizeof(mpc_ast_t*) * a->children_num);
+    }
+
+    for (i = 0; i < a->children_num; i++) {
+        r->children[i] = mpc_ast_copy(a->children[i], cost);
+    }
+    r->children_num = a->children_num;
+
+    return r;
+}
+
+/*
+** A copy of a for the memo table or for a hit on it. The
+** parsers using it may retag its root or fold it away,
+** but leave the nodes below alone, so in an arena only the
+** root and its array of children are new.
+*/
+static mpc_ast_t *mpc_ast_share(mpc_ast_t *a, int *cost) {
+
+    mpc_ast_t *r;
+
+    if (!mpc_arena_current) { return mpc_ast_copy(a, cost); }
+    if (a == NULL) { return NULL; }
+
+    r = mpc_arena_alloc(mpc_arena_current, sizeof(mpc_ast_t));
+    *r = *a;
+
+    if (a->children_num) {
+        r->children_num = 0;
+        r->children = mpc_arena_children(r, a->children_num);
+        memcpy(r->children, a->children, sizeof(mpc_ast_t*) * a->children_num);
+        r->children_num = a->children_num;
+    }
+
+    return r;
+}
+
 static void mpc_ast_delete_no_children(mpc_ast_t *a) {
+    if (mpc_arena_current) { return; }
     free(a->children);
     free(a->tag);
     free(a->contents);
@@ -2500,13 +3885,22 @@ static void mpc_ast_delete_no_children(mpc_ast_t *a) {
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
 
-    mpc_ast_t *a = malloc(sizeof(mpc_ast_t));
+    mpc_ast_t *a;
+    size_t tl = strlen(tag) + 1;
+    size_t cl = strlen(contents) + 1;
 
-    a->tag = malloc(strlen(tag) + 1);
-    strcpy(a->tag, tag);
+    if (mpc_arena_current) {
+        a = mpc_arena_alloc(mpc_arena_current, sizeof(mpc_ast_t) + tl + cl);
+        a->tag = (char*)(a + 1);
+        a->contents = a->tag + tl;
+    } else {
+        a = malloc(sizeof(mpc_ast_t));
+        a->tag = malloc(tl);
+        a->contents = malloc(cl);
+    }
 
-    a->contents = malloc(strlen(contents) + 1);
-    strcpy(a->contents, contents);
+    memcpy(a->tag, tag, tl);
+    memcpy(a->contents, contents, cl);
 
     a->state = mpc_state_new();
 
@@ -2563,6 +3957,12 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
 }
 
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
+    if (mpc_arena_current) {
+        r->children = mpc_arena_children(r, r->children_num + 1);
+        r->children_num++;
+        r->children[r->children_num-1] = a;
+        return r;
+    }
     r->children_num++;
     r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
     r->children[r->children_num-1] = a;
@@ -2570,7 +3970,16 @@ mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
 }
 
 mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
+    char *tag;
     if (a == NULL) { return a; }
+    if (mpc_arena_current) {
+        tag = mpc_arena_alloc(mpc_arena_current, strlen(t) + 1 + strlen(a->tag) + 1);
+        strcpy(tag, t);
+        strcat(tag, "|");
+        strcat(tag, a->tag);
+        a->tag = tag;
+        return a;
+    }
     a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
     memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
     memmove(a->tag, t, strlen(t));
@@ -2579,6 +3988,10 @@ mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
 }
 
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
+    if (mpc_arena_current) {
+        a->tag = mpc_arena_strdup(t);
+        return a;
+    }
     a->tag = realloc(a->tag, strlen(t) + 1);
     strcpy(a->tag, t);
     return a;
@@ -3041,6 +4454,7 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
         if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
         if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
         mpc_define(left, stmt->grammar);
+        left->memo = (st->flags & MPCA_LANG_PACKRAT) ? 1 : 0;
         free(stmt->ident);
         free(stmt->name);
         free(stmt);
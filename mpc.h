@@ -64,6 +64,30 @@ int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
 
+/*
+** Each thread keeps the stacks of its last parse for the next one. A thread
+** which is about to exit calls mpc_thread_cleanup to free them.
+*/
+void mpc_thread_cleanup(void);
+
+/*
+** Arena
+*/
+
+/*
+** mpc_parse_arena builds the AST of the result in the arena a. The tree is
+** freed by clearing or deleting the arena, not with mpc_ast_delete, and
+** should not be changed with the mpc_ast functions afterwards.
+*/
+
+typedef struct mpc_arena_t mpc_arena_t;
+
+mpc_arena_t *mpc_arena_new(void);
+void mpc_arena_clear(mpc_arena_t *a);
+void mpc_arena_delete(mpc_arena_t *a);
+
+int mpc_parse_arena(const char *filename, const char *string, mpc_parser_t *p, mpc_arena_t *a, mpc_result_t *r);
+
 /*
 ** Function Types
 */
@@ -298,7 +322,8 @@ mpc_parser_t *mpca_and(int n, ...);
 enum {
   MPCA_LANG_DEFAULT              = 0,
   MPCA_LANG_PREDICTIVE           = 1,
-  MPCA_LANG_WHITESPACE_SENSITIVE = 2
+  MPCA_LANG_WHITESPACE_SENSITIVE = 2,
+  MPCA_LANG_PACKRAT              = 4
 };
 
 mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...);
@@ -0,0 +1,66 @@
+/*
+** Parses deeply nested input with a packrat grammar whose
+** alternatives all start with the same rule. Every level
+** hits the memo table three times, which must not cost
+** the size of the tree below it, so this times out if it
+** does.
+*/
+
+#include "../mpc.h"
+
+#define DEPTH 3000
+
+static int depth(mpc_ast_t *a) {
+    int i, d = 0, x;
+    for (i = 0; i < a->children_num; i++) {
+        x = depth(a->children[i]);
+        if (x > d) { d = x; }
+    }
+    return d + 1;
+}
+
+int main(void) {
+
+    int k, n = 0, failed = 0;
+    char *in = malloc(2 * DEPTH + 2);
+    mpc_result_t r;
+    mpc_arena_t *arena = mpc_arena_new();
+
+    mpc_parser_t *E = mpc_new("e");
+    mpc_parser_t *T = mpc_new("t");
+    mpc_parser_t *Top = mpc_new("top");
+
+    mpca_lang(MPCA_LANG_PACKRAT,
+        " e   : <t> '+' <e> | <t> '-' <e> | <t> '*' <e> | <t> ; "
+        " t   : '(' <e> ')' | /[a-z]+/ ;                         "
+        " top : /^/ <e> /$/ ;                                    ",
+        E, T, Top, NULL);
+
+    for (k = 0; k < DEPTH; k++) { in[n++] = '('; }
+    in[n++] = 'a';
+    for (k = 0; k < DEPTH; k++) { in[n++] = ')'; }
+    in[n] = '\0';
+
+    if (mpc_parse("<test>", in, Top, &r)) {
+        if (depth(r.output) != DEPTH + 2) { printf("wrong tree depth %i\n", depth(r.output)); failed = 1; }
+        mpc_ast_delete(r.output);
+    } else {
+        mpc_err_print(r.error);
+        mpc_err_delete(r.error);
+        failed = 1;
+    }
+
+    if (mpc_parse_arena("<test>", in, Top, arena, &r)) {
+        if (depth(r.output) != DEPTH + 2) { printf("wrong tree depth %i in arena\n", depth(r.output)); failed = 1; }
+    } else {
+        mpc_err_print(r.error);
+        mpc_err_delete(r.error);
+        failed = 1;
+    }
+
+    mpc_arena_delete(arena);
+    mpc_cleanup(3, E, T, Top);
+    free(in);
+
+    return failed;
+}
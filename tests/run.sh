@@ -0,0 +1,33 @@
+#!/bin/sh
+# Runs every tests/*.lspy through the interpreter, once per reader, and
+# compares what it prints with the matching .out file. Every tests/*.c
+# is built against mpc.c and must exit with 0.
+#
+#   sh tests/run.sh              uses ./lispy and cc
+#   LISPY=/path/to/lispy CC=gcc sh tests/run.sh
+
+cd "$(dirname "$0")/.." || exit 1
+
+LISPY=${LISPY:-./lispy}
+CC=${CC:-cc}
+failed=0
+
+for t in tests/*.lspy; do
+    for flag in "" --mpc --hashcons; do
+        if ! timeout 20 "$LISPY" $flag < "$t" 2>&1 | diff -u "${t%.lspy}.out" - > /dev/null; then
+            echo "FAIL $t $flag"
+            failed=1
+        fi
+    done
+done
+
+for t in tests/*.c; do
+    if ! $CC -O2 -o "${t%.c}.bin" "$t" mpc.c -lm || ! timeout 20 "./${t%.c}.bin"; then
+        echo "FAIL $t"
+        failed=1
+    fi
+    rm -f "${t%.c}.bin"
+done
+
+[ $failed = 0 ] && echo "all tests passed"
+exit $failed